@@ -0,0 +1,264 @@
+#include "AABBTree.hpp"
+
+AABBTree::AABBTree(float margin)
+    : m_margin(margin)
+{
+}
+
+int AABBTree::create_proxy(const AABB& aabb, uint32_t userData)
+{
+    int proxy = allocate_node();
+    m_nodes[proxy].aabb = { aabb.min - glm::vec3(m_margin), aabb.max + glm::vec3(m_margin) };
+    m_nodes[proxy].userData = userData;
+    m_nodes[proxy].height = 0;
+
+    insert_leaf(proxy);
+    return proxy;
+}
+
+void AABBTree::destroy_proxy(int proxy)
+{
+    remove_leaf(proxy);
+    free_node(proxy);
+}
+
+bool AABBTree::move_proxy(int proxy, const AABB& aabb)
+{
+    if (m_nodes[proxy].aabb.contains(aabb)) {
+        return false;
+    }
+
+    remove_leaf(proxy);
+    m_nodes[proxy].aabb = { aabb.min - glm::vec3(m_margin), aabb.max + glm::vec3(m_margin) };
+    insert_leaf(proxy);
+    return true;
+}
+
+void AABBTree::clear()
+{
+    m_nodes.clear();
+    m_root = NULL_NODE;
+    m_freeList = NULL_NODE;
+}
+
+int AABBTree::allocate_node()
+{
+    if (m_freeList == NULL_NODE) {
+        m_nodes.emplace_back();
+        return (int)m_nodes.size() - 1;
+    }
+
+    int node = m_freeList;
+    m_freeList = m_nodes[node].next;
+    m_nodes[node] = Node {};
+    return node;
+}
+
+void AABBTree::free_node(int node)
+{
+    m_nodes[node].height = -1;
+    m_nodes[node].next = m_freeList;
+    m_freeList = node;
+}
+
+void AABBTree::insert_leaf(int leaf)
+{
+    if (m_root == NULL_NODE) {
+        m_root = leaf;
+        m_nodes[leaf].parent = NULL_NODE;
+        return;
+    }
+
+    // Descend towards the sibling that is cheapest to pair the leaf with. A child costs the area it would grow
+    // by plus the growth that is inherited by every ancestor on the way down.
+    AABB leafAABB = m_nodes[leaf].aabb;
+    int index = m_root;
+    while (!m_nodes[index].is_leaf()) {
+        const Node& node = m_nodes[index];
+
+        float area = node.aabb.surface_area();
+        float combinedArea = merge(node.aabb, leafAABB).surface_area();
+        float cost = 2.0f * combinedArea;
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        auto child_cost = [&](int child) {
+            float grownArea = merge(leafAABB, m_nodes[child].aabb).surface_area();
+            if (m_nodes[child].is_leaf()) {
+                return grownArea + inheritanceCost;
+            }
+            return grownArea - m_nodes[child].aabb.surface_area() + inheritanceCost;
+        };
+
+        float cost1 = child_cost(node.child1);
+        float cost2 = child_cost(node.child2);
+        if (cost < cost1 && cost < cost2) {
+            break;
+        }
+
+        index = cost1 < cost2 ? node.child1 : node.child2;
+    }
+
+    int sibling = index;
+    int oldParent = m_nodes[sibling].parent;
+    int newParent = allocate_node();
+    m_nodes[newParent].parent = oldParent;
+    m_nodes[newParent].aabb = merge(leafAABB, m_nodes[sibling].aabb);
+    m_nodes[newParent].height = m_nodes[sibling].height + 1;
+    m_nodes[newParent].child1 = sibling;
+    m_nodes[newParent].child2 = leaf;
+    m_nodes[sibling].parent = newParent;
+    m_nodes[leaf].parent = newParent;
+
+    if (oldParent == NULL_NODE) {
+        m_root = newParent;
+    } else if (m_nodes[oldParent].child1 == sibling) {
+        m_nodes[oldParent].child1 = newParent;
+    } else {
+        m_nodes[oldParent].child2 = newParent;
+    }
+
+    refit_ancestors(m_nodes[leaf].parent);
+}
+
+void AABBTree::remove_leaf(int leaf)
+{
+    if (leaf == m_root) {
+        m_root = NULL_NODE;
+        return;
+    }
+
+    int parent = m_nodes[leaf].parent;
+    int grandParent = m_nodes[parent].parent;
+    int sibling = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+    // The parent goes away and the sibling takes its place
+    m_nodes[sibling].parent = grandParent;
+    free_node(parent);
+
+    if (grandParent == NULL_NODE) {
+        m_root = sibling;
+        return;
+    }
+
+    if (m_nodes[grandParent].child1 == parent) {
+        m_nodes[grandParent].child1 = sibling;
+    } else {
+        m_nodes[grandParent].child2 = sibling;
+    }
+
+    refit_ancestors(grandParent);
+}
+
+void AABBTree::refit_ancestors(int index)
+{
+    while (index != NULL_NODE) {
+        index = balance(index);
+
+        Node& node = m_nodes[index];
+        const Node& child1 = m_nodes[node.child1];
+        const Node& child2 = m_nodes[node.child2];
+        node.height = 1 + std::max(child1.height, child2.height);
+        node.aabb = merge(child1.aabb, child2.aabb);
+
+        index = node.parent;
+    }
+}
+
+// Rotates the taller grandchild subtree up when the children of a node differ in height by more than one.
+// Returns the index of the node that now sits where the given one was.
+int AABBTree::balance(int iA)
+{
+    Node& A = m_nodes[iA];
+    if (A.is_leaf() || A.height < 2) {
+        return iA;
+    }
+
+    int iB = A.child1;
+    int iC = A.child2;
+    Node& B = m_nodes[iB];
+    Node& C = m_nodes[iC];
+
+    int heightDifference = C.height - B.height;
+
+    // Rotate C up
+    if (heightDifference > 1) {
+        int iF = C.child1;
+        int iG = C.child2;
+        Node& F = m_nodes[iF];
+        Node& G = m_nodes[iG];
+
+        C.child1 = iA;
+        C.parent = A.parent;
+        A.parent = iC;
+
+        if (C.parent == NULL_NODE) {
+            m_root = iC;
+        } else if (m_nodes[C.parent].child1 == iA) {
+            m_nodes[C.parent].child1 = iC;
+        } else {
+            m_nodes[C.parent].child2 = iC;
+        }
+
+        if (F.height > G.height) {
+            C.child2 = iF;
+            A.child2 = iG;
+            G.parent = iA;
+            A.aabb = merge(B.aabb, G.aabb);
+            C.aabb = merge(A.aabb, F.aabb);
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        } else {
+            C.child2 = iG;
+            A.child2 = iF;
+            F.parent = iA;
+            A.aabb = merge(B.aabb, F.aabb);
+            C.aabb = merge(A.aabb, G.aabb);
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+
+        return iC;
+    }
+
+    // Rotate B up
+    if (heightDifference < -1) {
+        int iD = B.child1;
+        int iE = B.child2;
+        Node& D = m_nodes[iD];
+        Node& E = m_nodes[iE];
+
+        B.child1 = iA;
+        B.parent = A.parent;
+        A.parent = iB;
+
+        if (B.parent == NULL_NODE) {
+            m_root = iB;
+        } else if (m_nodes[B.parent].child1 == iA) {
+            m_nodes[B.parent].child1 = iB;
+        } else {
+            m_nodes[B.parent].child2 = iB;
+        }
+
+        if (D.height > E.height) {
+            B.child2 = iD;
+            A.child1 = iE;
+            E.parent = iA;
+            A.aabb = merge(C.aabb, E.aabb);
+            B.aabb = merge(A.aabb, D.aabb);
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        } else {
+            B.child2 = iE;
+            A.child1 = iD;
+            D.parent = iA;
+            A.aabb = merge(C.aabb, D.aabb);
+            B.aabb = merge(A.aabb, E.aabb);
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+
+        return iB;
+    }
+
+    return iA;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Bounds.hpp>
+
+// Dynamic bounding volume hierarchy. Every leaf (proxy) stores an enlarged copy of the box it was given, so objects
+// that move a little stay inside their leaf and don't have to be reinserted. Inserts pick the sibling that grows the
+// tree's surface area the least and tree rotations keep it balanced.
+class AABBTree {
+public:
+    static constexpr int NULL_NODE = -1;
+
+    AABBTree(float margin = 0.1f);
+
+    int create_proxy(const AABB& aabb, uint32_t userData);
+    void destroy_proxy(int proxy);
+    // Returns true when the proxy had to be reinserted because the box left its enlarged bounds
+    bool move_proxy(int proxy, const AABB& aabb);
+
+    uint32_t get_user_data(int proxy) const { return m_nodes[proxy].userData; }
+    void set_user_data(int proxy, uint32_t userData) { m_nodes[proxy].userData = userData; }
+    const AABB& get_fat_aabb(int proxy) const { return m_nodes[proxy].aabb; }
+
+    int get_height() const { return m_root == NULL_NODE ? 0 : m_nodes[m_root].height; }
+    void clear();
+
+    // Walks every node whose box passes overlaps(const AABB&) and calls visit(userData) for the leaves
+    template <typename Overlaps, typename Visit>
+    void query(Overlaps&& overlaps, Visit&& visit) const
+    {
+        if (m_root == NULL_NODE) {
+            return;
+        }
+
+        m_stack.clear();
+        m_stack.push_back(m_root);
+        while (!m_stack.empty()) {
+            const Node& node = m_nodes[m_stack.back()];
+            m_stack.pop_back();
+
+            if (!overlaps(node.aabb)) {
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                visit(node.userData);
+            } else {
+                m_stack.push_back(node.child1);
+                m_stack.push_back(node.child2);
+            }
+        }
+    }
+
+private:
+    struct Node {
+        bool is_leaf() const { return child1 == NULL_NODE; }
+
+        AABB aabb;
+        uint32_t userData = 0;
+        int parent = NULL_NODE;
+        int child1 = NULL_NODE;
+        int child2 = NULL_NODE;
+        // Leaves have height 0, free nodes -1
+        int height = -1;
+        int next = NULL_NODE;
+    };
+
+    int allocate_node();
+    void free_node(int node);
+
+    void insert_leaf(int leaf);
+    void remove_leaf(int leaf);
+    int balance(int node);
+    void refit_ancestors(int node);
+
+    std::vector<Node> m_nodes;
+    int m_root = NULL_NODE;
+    int m_freeList = NULL_NODE;
+    float m_margin;
+
+    mutable std::vector<int> m_stack;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <ThirdParty/glm/glm.hpp>
+
+struct AABB {
+    glm::vec3 min {};
+    glm::vec3 max {};
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+    float surface_area() const
+    {
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    bool contains(const AABB& other) const
+    {
+        return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z
+            && max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+    }
+
+    bool overlaps(const AABB& other) const
+    {
+        return min.x <= other.max.x && min.y <= other.max.y && min.z <= other.max.z
+            && max.x >= other.min.x && max.y >= other.min.y && max.z >= other.min.z;
+    }
+};
+
+struct Sphere {
+    glm::vec3 center {};
+    float radius = 0.0f;
+};
+
+inline AABB merge(const AABB& a, const AABB& b)
+{
+    return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+// Bounds of a box after it has been transformed by an affine matrix
+inline AABB transform_aabb(const AABB& box, const glm::mat4& m)
+{
+    glm::vec3 center = glm::vec3(m * glm::vec4(box.center(), 1.0f));
+    glm::vec3 extent = box.extent();
+
+    glm::vec3 worldExtent;
+    for (int row = 0; row < 3; ++row) {
+        worldExtent[row] = std::abs(m[0][row]) * extent.x + std::abs(m[1][row]) * extent.y + std::abs(m[2][row]) * extent.z;
+    }
+
+    return { center - worldExtent, center + worldExtent };
+}
+
+inline bool overlaps(const AABB& box, const Sphere& sphere)
+{
+    glm::vec3 closest = glm::clamp(sphere.center, box.min, box.max);
+    glm::vec3 d = closest - sphere.center;
+    return glm::dot(d, d) <= sphere.radius * sphere.radius;
+}
+
+// Slab test. Returns whether the ray hits the box within maxDistance and if so the distance to the entry point.
+// A zero direction component makes its inverse infinite, the ray is then parallel to that slab and has to start in it.
+inline bool intersect_ray(const AABB& box, glm::vec3 origin, glm::vec3 invDirection, float maxDistance, float& distance)
+{
+    float enter = 0.0f;
+    float exit = maxDistance;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (std::isinf(invDirection[axis])) {
+            // Multiplying would give NaN for an origin on the slab's plane
+            if (origin[axis] < box.min[axis] || origin[axis] > box.max[axis]) {
+                return false;
+            }
+            continue;
+        }
+
+        float t0 = (box.min[axis] - origin[axis]) * invDirection[axis];
+        float t1 = (box.max[axis] - origin[axis]) * invDirection[axis];
+        enter = std::max(enter, std::min(t0, t1));
+        exit = std::min(exit, std::max(t0, t1));
+    }
+
+    distance = enter;
+    return enter <= exit;
+}
+
+struct Frustum {
+    // Extracts the planes from a combined projection and view matrix. Each plane is stored as (normal, distance)
+    // with the normal pointing into the frustum
+    static Frustum from_matrix(const glm::mat4& viewProj)
+    {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i) {
+            rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];
+        frustum.planes[1] = rows[3] - rows[0];
+        frustum.planes[2] = rows[3] + rows[1];
+        frustum.planes[3] = rows[3] - rows[1];
+        frustum.planes[4] = rows[3] + rows[2];
+        frustum.planes[5] = rows[3] - rows[2];
+
+        for (glm::vec4& plane : frustum.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+
+        return frustum;
+    }
+
+    bool intersects(const AABB& box) const
+    {
+        glm::vec3 center = box.center();
+        glm::vec3 extent = box.extent();
+        for (const glm::vec4& plane : planes) {
+            glm::vec3 normal(plane);
+            if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool intersects(const Sphere& sphere) const
+    {
+        for (const glm::vec4& plane : planes) {
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    glm::vec4 planes[6];
+};
+
+// Component holding the bounding box of an entity in its local space. Emit TransformChanged after changing it.
+struct Bounds {
+    AABB local;
+};
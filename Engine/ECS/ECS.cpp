@@ -1,13 +1,205 @@
 #include "ECS.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+// MSVC compiles AVX2 intrinsics in any function, the CPU is checked with cpuid before calling it
+#define ECS_AVX2_DISPATCH
+#define ECS_TARGET_AVX2
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ECS_AVX2_DISPATCH
+#define ECS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 using namespace ECS;
 
+static_assert(sizeof(ComponentMask) == 16, "match_signature assumes 128 bit component masks");
+
+// A mask matches when (mask & signature) == signature. The results are written branchlessly: every candidate index is
+// stored and the match count only advances past it if it matched. Each version goes from i to count and returns the
+// new match count.
+static size_t match_signature_scalar(const ComponentMask* masks, size_t i, size_t count, const ComponentMask& signature,
+    uint32_t* matches, size_t matchCount)
+{
+    for (; i < count; ++i) {
+        bool match = (masks[i].words[0] & signature.words[0]) == signature.words[0]
+            && (masks[i].words[1] & signature.words[1]) == signature.words[1];
+
+        matches[matchCount] = (uint32_t)i;
+        matchCount += match;
+    }
+
+    return matchCount;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+static size_t match_signature_sse2(const ComponentMask* masks, size_t count, const ComponentMask& signature, uint32_t* matches)
+{
+    size_t matchCount = 0;
+    __m128i sig = _mm_load_si128((const __m128i*)&signature);
+    for (size_t i = 0; i < count; ++i) {
+        __m128i m = _mm_load_si128((const __m128i*)&masks[i]);
+        int bits = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(m, sig), sig));
+
+        matches[matchCount] = (uint32_t)i;
+        matchCount += bits == 0xFFFF;
+    }
+
+    return matchCount;
+}
+#endif
+
+#if defined(ECS_AVX2_DISPATCH)
+// Two masks per iteration. masks must be 32 byte aligned, which EntityData::entityMasks is
+ECS_TARGET_AVX2 static size_t match_signature_avx2(const ComponentMask* masks, size_t count, const ComponentMask& signature, uint32_t* matches)
+{
+    size_t matchCount = 0;
+    size_t i = 0;
+    __m256i sig = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)&signature));
+    for (; i + 2 <= count; i += 2) {
+        __m256i m = _mm256_load_si256((const __m256i*)&masks[i]);
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi64(_mm256_and_si256(m, sig), sig));
+
+        matches[matchCount] = (uint32_t)i;
+        matchCount += (bits & 0xFFFF) == 0xFFFF;
+        matches[matchCount] = (uint32_t)i + 1;
+        matchCount += (bits >> 16) == 0xFFFF;
+    }
+
+    return match_signature_scalar(masks, i, count, signature, matches, matchCount);
+}
+
+static bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    // AVX has to be supported by the CPU and enabled by the OS, which saves the ymm registers when it does
+    bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+    if (!avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// The AVX2 version is picked at runtime, so builds for baseline x86-64 still use it where it is available
+size_t ECS::match_signature(const ComponentMask* masks, size_t count, const ComponentMask& signature, uint32_t* matches)
+{
+#if defined(ECS_AVX2_DISPATCH)
+    static const bool avx2 = cpu_supports_avx2();
+    if (avx2) {
+        return match_signature_avx2(masks, count, signature, matches);
+    }
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+    return match_signature_sse2(masks, count, signature, matches);
+#else
+    return match_signature_scalar(masks, 0, count, signature, matches, 0);
+#endif
+}
+
 EntityData& EntityData::getInstance()
 {
     static EntityData ed;
     return ed;
 }
 
+void FreeSlotStack::push(uint32_t slot)
+{
+    uint64_t oldHead = head.load(std::memory_order_relaxed);
+    uint64_t newHead;
+    do {
+        next[slot].store((uint32_t)oldHead, std::memory_order_relaxed);
+        newHead = (oldHead & 0xFFFFFFFF00000000ull) | slot;
+    } while (!head.compare_exchange_weak(oldHead, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool FreeSlotStack::pop(uint32_t& slot)
+{
+    uint64_t oldHead = head.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t index = (uint32_t)oldHead;
+        if (index == EMPTY) {
+            return false;
+        }
+
+        uint64_t newHead = (((oldHead >> 32) + 1) << 32) | next[index].load(std::memory_order_relaxed);
+        if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire, std::memory_order_acquire)) {
+            slot = index;
+            return true;
+        }
+    }
+}
+
+void FreeSlotStack::clear()
+{
+    head.store(EMPTY, std::memory_order_relaxed);
+}
+
+size_t EntityData::reserve_entity_slot()
+{
+    uint32_t freeSlot;
+    size_t insertPosition = 0;
+    if (freeEntitySlots.pop(freeSlot)) {
+        insertPosition = freeSlot;
+    } else {
+        insertPosition = entityInsertPosition.load(std::memory_order_relaxed);
+        do {
+            if (insertPosition >= MAX_ENTITIES) {
+                throw std::runtime_error("Tried to insert more than MAX_ENTITIES");
+            }
+        } while (!entityInsertPosition.compare_exchange_weak(insertPosition, insertPosition + 1, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    entities[insertPosition].active = true;
+    entities[insertPosition].eid = insertPosition;
+    updateTiers[insertPosition] = 0;
+    updatePhases[insertPosition] = (uint8_t)insertPosition;
+    liveEntityCount.fetch_add(1, std::memory_order_relaxed);
+
+    return insertPosition;
+}
+
+void EntityData::destroy_components(size_t eid)
+{
+    const ComponentMask& mask = entityMasks[eid];
+    for (size_t word = 0; word < MAX_COMPONENTS / 64; ++word) {
+        uint64_t bits = mask.words[word];
+        while (bits != 0) {
+            ComponentGroup& cg = componentGroups[word * 64 + std::countr_zero(bits)];
+            if (cg.destroy != nullptr) {
+                cg.destroy(cg.cgd, eid);
+            }
+            bits &= bits - 1;
+        }
+    }
+}
+
+SliceCursor::SliceCursor()
+{
+    EntityData::getInstance().sliceCursors.push_back(this);
+}
+
+SliceCursor::~SliceCursor()
+{
+    std::vector<SliceCursor*>& cursors = EntityData::getInstance().sliceCursors;
+    cursors.erase(std::find(cursors.begin(), cursors.end(), this));
+}
+
 Entity::Entity(size_t eid)
 {
     entityData = &EntityData::getInstance();
@@ -17,39 +209,62 @@ Entity::Entity(size_t eid)
     }
 }
 
-// Creates an entity adds it to EntityData. Returns an Entity wrapper.
-Entity EntityManager::add_entity(std::string entityName)
+std::optional<Entity> Entity::try_from(size_t eid) noexcept
 {
-    size_t insertPosition = 0;
-    if (entityData->freeEntitySlots.size() == 0 && entityData->entityInsertPosition < MAX_ENTITIES) {
-        insertPosition = entityData->entityInsertPosition;
-        entityData->entityInsertPosition++;
-    } else if (entityData->freeEntitySlots.size() > 0) {
-        insertPosition = entityData->freeEntitySlots.back();
-        entityData->freeEntitySlots.pop_back();
-    } else if (entityData->entityInsertPosition >= MAX_ENTITIES) {
-        throw std::runtime_error("Tried to insert more than MAX_ENTITIES");
+    EntityData* entityData = &EntityData::getInstance();
+    if (eid >= MAX_ENTITIES || !entityData->entities[eid].active) {
+        return std::nullopt;
     }
 
-    entityData->entities[insertPosition].active = true;
-    entityData->entities[insertPosition].eid = insertPosition;
+    return Entity(entityData, &entityData->entities[eid]);
+}
+
+// Creates an entity adds it to EntityData. Returns an Entity wrapper.
+Entity EntityManager::add_entity(std::string entityName)
+{
+    size_t insertPosition = entityData->reserve_entity_slot();
 
     // If a name wasn't provided generate one
     if (entityName.size() == 0) {
         entityName = "Unnamed Entity. EID = " + std::to_string(insertPosition);
     }
 
-    entityData->entityNames.insert({ entityName, &entityData->entities[insertPosition] });
+    {
+        std::lock_guard<std::mutex> lock(entityData->entityNamesMutex);
+        auto inserted = entityData->entityNames.insert({ entityName, &entityData->entities[insertPosition] });
+        if (inserted.second) {
+            entityData->entities[insertPosition].name = &inserted.first->first;
+        }
+    }
     return Entity(insertPosition);
 }
 
+Entity EntityManager::reserve_entity()
+{
+    return Entity(entityData->reserve_entity_slot());
+}
+
 void EntityManager::remove_entity(Entity e)
 {
-    e.entity->active = false;
-    entityData->freeEntitySlots.push_back(e.entity->eid);
+    size_t eid = e.entity->eid;
 
+    if (e.entity->name != nullptr) {
+        std::lock_guard<std::mutex> lock(entityData->entityNamesMutex);
+        entityData->entityNames.erase(*e.entity->name);
+        e.entity->name = nullptr;
+    }
+
+    entityData->timers.cancel_entity((uint32_t)eid);
+    entityData->destroy_components(eid);
+    entityData->entityMasks[eid].clear();
+    entityData->compactionCursor = std::min(entityData->compactionCursor, eid);
     e.entity->eid = -1;
-    e.entity->activeComponents.reset();
+    e.entity->active = false;
+    entityData->liveEntityCount.fetch_sub(1, std::memory_order_relaxed);
+
+    // Last, since reserve_entity() may hand the slot out again on another thread as soon as it is pushed. The push
+    // releases the reset above to whoever pops it
+    entityData->freeEntitySlots.push((uint32_t)eid);
 }
 
 void EntityManager::remove_entity(std::string entityName)
@@ -59,23 +274,217 @@ void EntityManager::remove_entity(std::string entityName)
 
 Entity EntityManager::get_entity_by_name(std::string entityName)
 {
-    try {
-        return Entity(entityData->entityNames.at(entityName)->eid);
-    } catch (std::runtime_error e) {
-        // Throw a more descriptive error
+    std::optional<Entity> e = try_get_entity_by_name(entityName);
+    if (!e.has_value()) {
         throw std::runtime_error("Provided entity name is not in use");
     }
+
+    return e.value();
+}
+
+std::optional<Entity> EntityManager::try_get_entity_by_name(const std::string& entityName, Error* error) noexcept
+{
+    // Unlike lock(), try_lock() and unlock() never throw. The lock is only ever held for a hash map operation.
+    while (!entityData->entityNamesMutex.try_lock()) {
+        std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> lock(entityData->entityNamesMutex, std::adopt_lock);
+    auto it = entityData->entityNames.find(entityName);
+    if (it == entityData->entityNames.end()) {
+        if (error != nullptr) {
+            *error = Error::NameNotFound;
+        }
+        return std::nullopt;
+    }
+
+    return Entity(entityData, it->second);
 }
 
 void EntityManager::update(double dt_ms)
 {
-    for (System* system : entityData->systems) {
-        system->update(dt_ms);
+    using Clock = std::chrono::steady_clock;
+
+    entityData->tick++;
+    EventBus::getInstance().swap();
+    entityData->timers.advance();
+
+    for (size_t i = 0; i < entityData->systems.size(); ++i) {
+        Clock::time_point start = Clock::now();
+        entityData->systems[i]->update(dt_ms);
+        entityData->systemTimings[i].record(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
     }
 
-    for (System* system : entityData->updateLastSystems) {
-        system->update(dt_ms);
+    for (size_t i = 0; i < entityData->updateLastSystems.size(); ++i) {
+        Clock::time_point start = Clock::now();
+        entityData->updateLastSystems[i]->update(dt_ms);
+        entityData->updateLastSystemTimings[i].record(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+}
+
+std::vector<const SystemTimings*> EntityManager::get_system_timings()
+{
+    std::vector<const SystemTimings*> timings;
+    for (const SystemTimings& t : entityData->systemTimings) {
+        timings.push_back(&t);
+    }
+    for (const SystemTimings& t : entityData->updateLastSystemTimings) {
+        timings.push_back(&t);
+    }
+    return timings;
+}
+
+void EntityManager::dump_system_timings(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open system timings file");
+    }
+
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+        write_system_timings_json(file, get_system_timings());
+    } else {
+        write_system_timings_csv(file, get_system_timings());
+    }
+}
+
+TimerHandle EntityManager::schedule(Entity e, uint64_t delayTicks, std::function<void(Entity&)> f)
+{
+    return entityData->timers.schedule((uint32_t)e.entity->eid, delayTicks, [f](size_t eid) {
+        Entity e(eid);
+        f(e);
+    });
+}
+
+bool EntityManager::cancel_timer(TimerHandle handle)
+{
+    return entityData->timers.cancel(handle);
+}
+
+void EntityManager::set_update_tier(Entity e, int tier)
+{
+    entityData->updateTiers[e.entity->eid] = (uint8_t)std::clamp(tier, 0, MAX_UPDATE_TIER);
+}
+
+bool EntityManager::compact(double budget_ms)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(budget_ms));
+
+    size_t insertPosition = entityData->entityInsertPosition.load(std::memory_order_acquire);
+    size_t& hole = entityData->compactionCursor;
+    bool compacted = false;
+
+    while (true) {
+        while (hole < insertPosition && entityData->entities[hole].active) {
+            hole++;
+        }
+        while (insertPosition > hole && !entityData->entities[insertPosition - 1].active) {
+            insertPosition--;
+        }
+        if (hole >= insertPosition) {
+            compacted = true;
+            break;
+        }
+        if (Clock::now() >= deadline) {
+            break;
+        }
+
+        relocate_entity(insertPosition - 1, hole);
+        insertPosition--;
     }
+
+    // Everything below the cursor is active, so the only free slots left are between it and the new insert position.
+    // Push them highest first so that the lowest holes get filled first.
+    entityData->entityInsertPosition = insertPosition;
+    entityData->freeEntitySlots.clear();
+    for (size_t i = insertPosition; i > hole; --i) {
+        if (!entityData->entities[i - 1].active) {
+            entityData->freeEntitySlots.push((uint32_t)(i - 1));
+        }
+    }
+
+    return compacted;
+}
+
+void EntityManager::on_entity_relocated(std::function<void(size_t from, size_t to)> f)
+{
+    entityData->relocationListeners.push_back(f);
+}
+
+void EntityManager::relocate_entity(size_t from, size_t to)
+{
+    ComponentMask mask = entityData->entityMasks[from];
+    for (size_t word = 0; word < MAX_COMPONENTS / 64; ++word) {
+        uint64_t bits = mask.words[word];
+        while (bits != 0) {
+            ComponentGroup& cg = entityData->componentGroups[word * 64 + std::countr_zero(bits)];
+            cg.relocate(cg.cgd, from, to);
+            bits &= bits - 1;
+        }
+    }
+    entityData->entityMasks[to] = mask;
+    entityData->entityMasks[from].clear();
+    entityData->updateTiers[to] = entityData->updateTiers[from];
+    entityData->updatePhases[to] = entityData->updatePhases[from];
+    entityData->timers.relocate_entity((uint32_t)from, (uint32_t)to);
+
+    RawEntity& src = entityData->entities[from];
+    RawEntity& dst = entityData->entities[to];
+    dst.active = true;
+    dst.eid = to;
+    dst.name = src.name;
+    if (dst.name != nullptr) {
+        entityData->entityNames.find(*dst.name)->second = &dst;
+    }
+
+    src.active = false;
+    src.eid = -1;
+    src.name = nullptr;
+
+    // The entity moved from where a pass still has to go to where it has already been, so the pass goes back for it
+    for (SliceCursor* cursor : entityData->sliceCursors) {
+        if (from >= cursor->position && to < cursor->position) {
+            cursor->position = to;
+        }
+    }
+
+    for (auto& listener : entityData->relocationListeners) {
+        listener(from, to);
+    }
+}
+
+// Removes all entities. Removed entities leave their slot cleared, so only the live ones need to be visited, and the
+// walk stops as soon as it has seen all of them. Component groups stay allocated and keep their cgids, which lets a
+// reloaded level add components without going through calloc again.
+void EntityManager::reset()
+{
+    size_t remaining = entityData->liveEntityCount.load(std::memory_order_acquire);
+    for (size_t i = 0; remaining > 0; ++i) {
+        RawEntity& entity = entityData->entities[i];
+        if (!entity.active) {
+            continue;
+        }
+
+        entityData->destroy_components(i);
+        entityData->entityMasks[i].clear();
+        entity.active = false;
+        entity.eid = -1;
+        entity.name = nullptr;
+        --remaining;
+    }
+
+    entityData->entityInsertPosition = 0;
+    entityData->liveEntityCount = 0;
+    entityData->freeEntitySlots.clear();
+    entityData->compactionCursor = 0;
+    for (SliceCursor* cursor : entityData->sliceCursors) {
+        cursor->position = 0;
+    }
+
+    entityData->entityNames.clear();
+
+    EventBus::getInstance().clear();
+    entityData->timers.clear();
 }
 
 // Resets the ECS and removes all entities and components
@@ -93,15 +502,18 @@ void EntityManager::clear()
     }
 
     entityData->updateLastSystems.clear();
-    for (int i = 0; i < MAX_ENTITIES; ++i) {
-        entityData->entities[i].active = false;
-        entityData->entities[i].eid = -1;
-        entityData->entities[i].activeComponents.reset();
-    }
 
-    for (int i = 0; i < MAX_COMPONENTS; ++i) {
+    entityData->systemTimings.clear();
+    entityData->updateLastSystemTimings.clear();
+    entityData->relocationListeners.clear();
+
+    reset();
+
+    for (int i = 0; i < entityData->componentInsertPosition; ++i) {
         entityData->componentGroups[i].cgid = -1;
         entityData->componentGroups[i].cgd = nullptr;
+        entityData->componentGroups[i].relocate = nullptr;
+        entityData->componentGroups[i].destroy = nullptr;
     }
 
     for (auto alloc : entityData->allocations) {
@@ -114,13 +526,8 @@ void EntityManager::clear()
     }
     entityData->staticCgids.clear();
 
-    entityData->entityInsertPosition = 0;
-    entityData->freeEntitySlots.clear();
-
     entityData->componentInsertPosition = 0;
     entityData->freeComponentSlots.clear();
-
-    entityData->entityNames.clear();
 }
 
 EntityManager& EntityManager::getInstance()
@@ -1,40 +1,149 @@
 #pragma once
-#include <bitset>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
 #include <unordered_map>
 #include <vector>
 
+#include <ECS/EventBus.hpp>
+#include <ECS/SystemTimings.hpp>
+#include <ECS/TimerWheel.hpp>
+
 namespace ECS {
 // The maximum number of entities that can be active at once
 constexpr int MAX_ENTITIES = 8192;
 // The maximum number of unique component types in the scene
 constexpr int MAX_COMPONENTS = 128;
 
+// Entities in update tier n are processed by tiered systems every 2^n ticks
+constexpr int MAX_UPDATE_TIER = 7;
+
+// each_component_sliced() reads the clock once per this many entities
+constexpr size_t SLICE_BUDGET_CHECK_INTERVAL = 32;
+
+// Reported by the try_ functions, which don't throw
+enum class Error {
+    None,
+    TooManyComponentTypes,
+    OutOfMemory,
+    ComponentAlreadyAdded,
+    ComponentNotAdded,
+    InactiveEntity,
+    NameNotFound,
+};
+
 template <typename T>
 struct ComponentGroupData {
     // Indexed into with Entity::eid to get the component of the templated type that corresponds to that entity
     T components[MAX_ENTITIES];
 };
 
+// Component groups are calloc'd and add_component() assigns over the zeroed slots, so a destroyed component is
+// zeroed again to leave its slot the way it found it
+template <typename T>
+void destroy_component(void* cgd, size_t eid)
+{
+    T* component = &((ComponentGroupData<T>*)cgd)->components[eid];
+    std::destroy_at(component);
+    std::memset((void*)component, 0, sizeof(T));
+}
+
 // Untemplated wrapper around a pointer to a ComponentGroupData so that objects of this type can be stored in an array
 struct ComponentGroup {
     void* cgd = nullptr;
     size_t cgid = -1;
+
+    // Moves the component of one entity into the slot of another
+    void (*relocate)(void* cgd, size_t from, size_t to) = nullptr;
+    // Runs the destructor of the component of an entity and zeroes its slot again. Null for trivially destructible types
+    void (*destroy)(void* cgd, size_t eid) = nullptr;
+};
+
+// Describes which components are active for an entity. Kept out of RawEntity in a tightly packed array so that
+// queries can match a whole signature against many entities at once with SIMD.
+struct alignas(16) ComponentMask {
+    void set(size_t cgid) { words[cgid / 64] |= (uint64_t)1 << (cgid % 64); }
+    void reset(size_t cgid) { words[cgid / 64] &= ~((uint64_t)1 << (cgid % 64)); }
+    bool test(size_t cgid) const { return (words[cgid / 64] >> (cgid % 64)) & 1; }
+    void clear() { words[0] = words[1] = 0; }
+
+    uint64_t words[MAX_COMPONENTS / 64] = {};
+};
+
+// Writes the index of every mask that contains all of the bits in signature to matches, which must have room
+// for count entries. Returns the number of matches.
+size_t match_signature(const ComponentMask* masks, size_t count, const ComponentMask& signature, uint32_t* matches);
+
+// A match buffer for each_component() and the like that keeps its capacity between calls. Buffers are per thread and
+// per nesting level, so the function passed to each_component() can run queries of its own.
+class ScratchMatches {
+public:
+    ScratchMatches()
+        : m_level(depth()++)
+    {
+        // A deque so that adding a level doesn't move the buffers of the levels below, which are still in use
+        if (m_level == pool().size()) {
+            pool().emplace_back();
+        }
+    }
+    ~ScratchMatches() { depth()--; }
+
+    ScratchMatches(const ScratchMatches&) = delete;
+    ScratchMatches& operator=(const ScratchMatches&) = delete;
+
+    std::vector<uint32_t>& get() { return pool()[m_level]; }
+
+private:
+    static std::deque<std::vector<uint32_t>>& pool()
+    {
+        thread_local std::deque<std::vector<uint32_t>> buffers;
+        return buffers;
+    }
+    static size_t& depth()
+    {
+        thread_local size_t level = 0;
+        return level;
+    }
+
+    size_t m_level;
 };
 
 struct RawEntity {
     // Unique id for this entity
     size_t eid = 0;
-    // Describes which components are active for this entity
-    std::bitset<MAX_COMPONENTS> activeComponents;
+    // Points to this entity's key in EntityData::entityNames, or nullptr if it has no name
+    const std::string* name = nullptr;
 
     bool active = false;
 };
 
+// Lock-free LIFO stack of free entity slots that can be pushed to and popped from on any thread.
+// The upper half of head is a tag that is bumped on every pop so that a slot which was popped and pushed
+// back between another thread's load and compare-exchange (ABA) is detected.
+struct FreeSlotStack {
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    void push(uint32_t slot);
+    bool pop(uint32_t& slot);
+    // Not thread-safe. Only call while no other thread is using the stack
+    void clear();
+
+    std::atomic<uint64_t> head { EMPTY };
+    // Links each free slot to the one below it on the stack
+    std::atomic<uint32_t> next[MAX_ENTITIES];
+};
+
 // Abstract system class
 class EntityManager;
 class System {
@@ -44,42 +153,145 @@ public:
     virtual void exit() = 0;
 };
 
+// The point in time by which a time-sliced system has to hand control back
+class FrameBudget {
+public:
+    FrameBudget(double budget_ms)
+        : m_deadline(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(budget_ms)))
+    {
+    }
+
+    bool exhausted() const { return Clock::now() >= m_deadline; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point m_deadline;
+};
+
+// Where an each_component_sliced() pass left off. Registered with the ECS for as long as it exists, so that compact()
+// can move it back when it relocates an entity that wasn't reached yet to below it, and reset() can rewind it.
+class SliceCursor {
+public:
+    SliceCursor();
+    ~SliceCursor();
+
+    // Registered by address
+    SliceCursor(const SliceCursor&) = delete;
+    SliceCursor& operator=(const SliceCursor&) = delete;
+
+    size_t position = 0;
+};
+
+// A system whose work is spread over several updates. Each update it may spend budget_ms, after which it should
+// stop and continue from where it left off on the next update.
+class TimeSlicedSystem : public System {
+public:
+    void update(double dt_ms) override
+    {
+        update_slice(dt_ms, FrameBudget(budget_ms));
+    }
+
+    virtual void update_slice(double dt_ms, const FrameBudget& budget) = 0;
+
+    double budget_ms = 1.0;
+};
+
 // Singleton class due to the method that get_component_group() uses to find the correct ComponentGroup for a given type
 struct EntityData {
+    // This method of figuring out the type with a static variable in a templated function means this class must be a singleton
     template <typename T>
-    ComponentGroup* get_component_group()
+    static size_t& component_cgid() noexcept
     {
-        // This method of figuring out the type with a static variable in a templated function means this class must be a singleton
-        static uint64_t cgid = -1;
+        static size_t cgid = -1;
+        return cgid;
+    }
+
+    // Returns nullptr if the type hasn't been registered yet. Unlike get_component_group() it never registers it, so
+    // it doesn't allocate and only reads
+    template <typename T>
+    ComponentGroup* find_component_group() noexcept
+    {
+        size_t cgid = component_cgid<T>();
+        return cgid == (size_t)-1 ? nullptr : &componentGroups[cgid];
+    }
+
+    // Non-throwing version of get_component_group(). Returns nullptr and sets error if the type couldn't be registered
+    template <typename T>
+    ComponentGroup* try_get_component_group(Error* error = nullptr) noexcept
+    {
+        size_t& cgid = component_cgid<T>();
 
         // get_component_group() has not been called for this type before. Create a spot for it in componentGroups
         if (cgid == -1) {
-            // Store the location of cgid for this particular templated type so that the ECS can be reset
-            staticCgids.push_back(&cgid);
+            size_t slot = 0;
+            if (freeComponentSlots.size() > 0) {
+                slot = freeComponentSlots.back();
+            } else if (componentInsertPosition < MAX_COMPONENTS) {
+                slot = componentInsertPosition;
+            } else {
+                if (error != nullptr) {
+                    *error = Error::TooManyComponentTypes;
+                }
+                return nullptr;
+            }
 
-            if (freeComponentSlots.size() == 0 && componentInsertPosition < MAX_COMPONENTS) {
-                componentGroups[componentInsertPosition].cgid = componentInsertPosition;
-                componentGroups[componentInsertPosition].cgd = calloc(1, sizeof(ComponentGroupData<T>));
-                allocations.push_back(componentGroups[componentInsertPosition].cgd);
+            void* cgd = calloc(1, sizeof(ComponentGroupData<T>));
+            if (cgd == nullptr) {
+                if (error != nullptr) {
+                    *error = Error::OutOfMemory;
+                }
+                return nullptr;
+            }
 
-                cgid = componentInsertPosition;
-                componentInsertPosition++;
-            } else if (freeComponentSlots.size() > 0) {
-                componentGroups[freeComponentSlots.back()].cgid = freeComponentSlots.back();
-                componentGroups[freeComponentSlots.back()].cgd = calloc(1, sizeof(ComponentGroupData<T>));
-                allocations.push_back(componentGroups[freeComponentSlots.back()].cgd);
+            // Store the location of cgid for this particular templated type so that the ECS can be reset.
+            // Both vectors have room for MAX_COMPONENTS entries reserved up front so these can't throw.
+            staticCgids.push_back(&cgid);
+            allocations.push_back(cgd);
+
+            componentGroups[slot].cgid = slot;
+            componentGroups[slot].cgd = cgd;
+            componentGroups[slot].relocate = [](void* cgd, size_t from, size_t to) {
+                ComponentGroupData<T>* data = (ComponentGroupData<T>*)cgd;
+                data->components[to] = std::move(data->components[from]);
+                if constexpr (!std::is_trivially_destructible_v<T>) {
+                    destroy_component<T>(cgd, from);
+                }
+            };
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                componentGroups[slot].destroy = destroy_component<T>;
+            }
 
-                cgid = freeComponentSlots.back();
+            if (freeComponentSlots.size() > 0) {
                 freeComponentSlots.pop_back();
-            } else if (componentInsertPosition >= MAX_COMPONENTS) {
-                throw std::runtime_error("Maximum number of unique component types, MAX_COMPONENTS, exceeded. Cannot add another component");
+            } else {
+                componentInsertPosition++;
             }
+            cgid = slot;
         }
 
         return &componentGroups[cgid];
     }
 
-    EntityData() { }
+    template <typename T>
+    ComponentGroup* get_component_group()
+    {
+        Error error = Error::None;
+        ComponentGroup* cg = try_get_component_group<T>(&error);
+        if (cg == nullptr) {
+            if (error == Error::TooManyComponentTypes) {
+                throw std::runtime_error("Maximum number of unique component types, MAX_COMPONENTS, exceeded. Cannot add another component");
+            }
+            throw std::runtime_error("Failed to allocate component storage");
+        }
+
+        return cg;
+    }
+
+    EntityData()
+    {
+        staticCgids.reserve(MAX_COMPONENTS);
+        allocations.reserve(MAX_COMPONENTS);
+    }
 
     // Singleton class
     static EntityData& getInstance();
@@ -92,11 +304,38 @@ struct EntityData {
     // Indicates free positions behind the insertPosition
     std::vector<size_t> freeComponentSlots;
 
+    // Claims a slot in entities and marks it active. Safe to call from multiple threads at once
+    size_t reserve_entity_slot();
+    // Destroys every component in the mask of eid that isn't trivially destructible, leaving the mask as it is
+    void destroy_components(size_t eid);
+
     RawEntity entities[MAX_ENTITIES];
-    size_t entityInsertPosition = 0;
-    std::vector<size_t> freeEntitySlots;
+    // Indexed into with Entity::eid. Inactive entities always have an empty mask
+    alignas(32) ComponentMask entityMasks[MAX_ENTITIES];
+    // Indexed into with Entity::eid. See MAX_UPDATE_TIER
+    uint8_t updateTiers[MAX_ENTITIES] = {};
+    // Indexed into with Entity::eid. Offsets the ticks an entity's tier is due on, so that the entities of a tier are
+    // spread over its period. Taken from the eid when the entity is created and moved along with it by compaction.
+    uint8_t updatePhases[MAX_ENTITIES] = {};
+    // The number of times EntityManager::update has run
+    uint64_t tick = 0;
+
+    TimerWheel timers { MAX_ENTITIES };
+    std::atomic<size_t> entityInsertPosition = 0;
+    FreeSlotStack freeEntitySlots;
+    // Active entities, so that reset() can stop once it has come across all of them
+    std::atomic<size_t> liveEntityCount = 0;
 
     std::unordered_map<std::string, RawEntity*> entityNames;
+    // entityNames is shared by every thread that creates or looks up named entities
+    std::mutex entityNamesMutex;
+
+    // Every slot below this is known to be active, so compaction can start looking for holes here
+    size_t compactionCursor = 0;
+    // Called with the old and new eid whenever compaction moves an entity
+    std::vector<std::function<void(size_t, size_t)>> relocationListeners;
+    // Every SliceCursor that currently exists
+    std::vector<SliceCursor*> sliceCursors;
 
     // Keeps track of allocations made in get_component_group so that the ECS can be reset and not leak memory
     std::vector<void*> allocations;
@@ -106,6 +345,10 @@ struct EntityData {
     std::vector<System*> systems;
     // Systems that should be run after the other systems
     std::vector<System*> updateLastSystems;
+
+    // Indexed the same as systems and updateLastSystems
+    std::vector<SystemTimings> systemTimings;
+    std::vector<SystemTimings> updateLastSystemTimings;
 };
 
 // User friendly wrapper around RawEntity
@@ -118,26 +361,27 @@ public:
     {
         ComponentGroup* cg = entityData->get_component_group<T>();
         ComponentGroupData<T>* cgd = (ComponentGroupData<T>*)cg->cgd;
+        ComponentMask& mask = entityData->entityMasks[entity->eid];
         //Check that this entity doesn't already have this component
-        if (entity->activeComponents.test(cg->cgid) == true) {
+        if (mask.test(cg->cgid) == true) {
             throw std::runtime_error("This entity already has the given component type");
         }
 
         cgd->components[entity->eid] = T(std::forward<Args>(args)...);
 
-        entity->activeComponents.set(cg->cgid, true);
+        mask.set(cg->cgid);
     }
 
     template <typename T>
     std::optional<T*> get_component()
     {
-        ComponentGroup* cg = entityData->get_component_group<T>();
-        ComponentGroupData<T>* cgd = (ComponentGroupData<T>*)cg->cgd;
-        if (entity->activeComponents.test(cg->cgid) == false) {
+        // No entity can have a component of a type that was never registered
+        ComponentGroup* cg = entityData->find_component_group<T>();
+        if (cg == nullptr || entityData->entityMasks[entity->eid].test(cg->cgid) == false) {
             return std::optional<T*>();
         }
 
-        return &cgd->components[entity->eid];
+        return &((ComponentGroupData<T>*)cg->cgd)->components[entity->eid];
     }
 
     template <typename T>
@@ -145,12 +389,88 @@ public:
     {
         ComponentGroup* cg = entityData->get_component_group<T>();
         ComponentGroupData<T>* cgd = (ComponentGroupData<T>*)cg->cgd;
+        ComponentMask& mask = entityData->entityMasks[entity->eid];
         // Make sure that the entity does have this component
-        if (entity->activeComponents.test(cg->cgid) == false) {
+        if (mask.test(cg->cgid) == false) {
             throw std::runtime_error("Cannot remove component that has not been added");
         }
 
-        entity->activeComponents.set(cg->cgid, false);
+        if (cg->destroy != nullptr) {
+            cg->destroy(cg->cgd, entity->eid);
+        }
+        mask.reset(cg->cgid);
+    }
+
+    // Non-throwing alternative to the constructor. Returns an empty optional if eid is not an active entity
+    static std::optional<Entity> try_from(size_t eid) noexcept;
+
+    // Non-throwing version of add_component()
+    template <typename T, class... Args>
+    Error try_add_component(Args&&... args) noexcept(std::is_nothrow_constructible_v<T, Args...> && std::is_nothrow_move_assignable_v<T>)
+    {
+        if (!entity->active) {
+            return Error::InactiveEntity;
+        }
+
+        Error error = Error::None;
+        ComponentGroup* cg = entityData->try_get_component_group<T>(&error);
+        if (cg == nullptr) {
+            return error;
+        }
+
+        ComponentMask& mask = entityData->entityMasks[entity->eid];
+        if (mask.test(cg->cgid)) {
+            return Error::ComponentAlreadyAdded;
+        }
+
+        ((ComponentGroupData<T>*)cg->cgd)->components[entity->eid] = T(std::forward<Args>(args)...);
+        mask.set(cg->cgid);
+
+        return Error::None;
+    }
+
+    // Non-throwing version of get_component(). Returns nullptr and sets error to InactiveEntity if the entity has been
+    // removed, or to ComponentNotAdded if it doesn't have the component
+    template <typename T>
+    T* try_get_component(Error* error = nullptr) noexcept
+    {
+        if (!entity->active) {
+            if (error != nullptr) {
+                *error = Error::InactiveEntity;
+            }
+            return nullptr;
+        }
+
+        ComponentGroup* cg = entityData->find_component_group<T>();
+        if (cg == nullptr || !entityData->entityMasks[entity->eid].test(cg->cgid)) {
+            if (error != nullptr) {
+                *error = Error::ComponentNotAdded;
+            }
+            return nullptr;
+        }
+
+        return &((ComponentGroupData<T>*)cg->cgd)->components[entity->eid];
+    }
+
+    // Non-throwing version of remove_component()
+    template <typename T>
+    Error try_remove_component() noexcept
+    {
+        if (!entity->active) {
+            return Error::InactiveEntity;
+        }
+
+        ComponentGroup* cg = entityData->find_component_group<T>();
+        ComponentMask& mask = entityData->entityMasks[entity->eid];
+        if (cg == nullptr || !mask.test(cg->cgid)) {
+            return Error::ComponentNotAdded;
+        }
+
+        if (cg->destroy != nullptr) {
+            cg->destroy(cg->cgd, entity->eid);
+        }
+        mask.reset(cg->cgid);
+        return Error::None;
     }
 
     int get_eid()
@@ -159,23 +479,76 @@ public:
     }
 
 private:
+    Entity(EntityData* entityData, RawEntity* entity) noexcept
+        : entityData(entityData)
+        , entity(entity)
+    {
+    }
+
     EntityData* entityData = nullptr;
     RawEntity* entity = nullptr;
 
     friend class EntityManager;
 };
 
+// The components of one type, looked up once so that worker threads can read them by eid without going through
+// Entity, which would look the type up on every call. Only valid while no component types are registered and no
+// components of this type are added or removed.
+template <typename T>
+class ComponentView {
+public:
+    ComponentView(EntityData& entityData)
+        : m_masks(entityData.entityMasks)
+    {
+        ComponentGroup* cg = entityData.find_component_group<T>();
+        if (cg != nullptr) {
+            m_cgid = cg->cgid;
+            m_cgd = (ComponentGroupData<T>*)cg->cgd;
+        }
+    }
+
+    // Returns nullptr if the entity doesn't have the component
+    T* get(size_t eid) const
+    {
+        if (m_cgd == nullptr || !m_masks[eid].test(m_cgid)) {
+            return nullptr;
+        }
+
+        return &m_cgd->components[eid];
+    }
+
+private:
+    const ComponentMask* m_masks;
+    size_t m_cgid = -1;
+    ComponentGroupData<T>* m_cgd = nullptr;
+};
+
 // User friendly wrapper around ECS data types. Singleton class because entityData also is.
 class EntityManager {
 public:
     EntityManager();
 
     Entity add_entity(std::string entityName = std::string());
+    // Creates an unnamed entity without touching the name index. Lock-free, so worker threads can spawn entities
+    // in parallel. Entities created this way must not be iterated over until the creating threads are joined.
+    Entity reserve_entity();
     void remove_entity(Entity e);
     void remove_entity(std::string entityName);
     Entity get_entity_by_name(std::string entityName);
+    // Version of get_entity_by_name() that reports a missing name through error, as NameNotFound, rather than
+    // throwing. Costs a single hash lookup. Spins on try_lock() rather than calling lock(), which can throw.
+    std::optional<Entity> try_get_entity_by_name(const std::string& entityName, Error* error = nullptr) noexcept;
     void update(double dt_ms);
 
+    // Moves entities from the end of the entity array into the holes left by removed ones, for at most budget_ms.
+    // Returns true once there are no holes left. Moved entities get a new eid, so Entity wrappers and eids held from
+    // before the call are invalidated. Look them up by name again or keep track of them with on_entity_relocated.
+    // Must not run at the same time as anything else that uses the ECS.
+    bool compact(double budget_ms);
+    void on_entity_relocated(std::function<void(size_t from, size_t to)> f);
+
+    // Removes every entity but keeps the systems and the component storage around for the next level
+    void reset();
     void clear();
 
     // Adds a new system to the Entity Manager. Returns a pointer to the constructed system
@@ -184,6 +557,23 @@ public:
     {
         T* system = new T(std::forward<Args>(args)...);
         entityData->systems.push_back((System*)system);
+        entityData->systemTimings.emplace_back().name = system_type_name(typeid(T).name());
+
+        system->init();
+
+        return *system;
+    }
+
+    // Adds a system derived from TimeSlicedSystem that may spend at most budget_ms per update
+    template <typename T, class... Args>
+    T& add_time_sliced_system(double budget_ms, Args&&... args)
+    {
+        static_assert(std::is_base_of_v<TimeSlicedSystem, T>, "Time-sliced systems must derive from TimeSlicedSystem");
+
+        T* system = new T(std::forward<Args>(args)...);
+        system->budget_ms = budget_ms;
+        entityData->systems.push_back((System*)system);
+        entityData->systemTimings.emplace_back().name = system_type_name(typeid(T).name());
 
         system->init();
 
@@ -196,20 +586,165 @@ public:
     {
         T* system = new T(std::forward<Args>(args)...);
         entityData->updateLastSystems.push_back((System*)system);
+        entityData->updateLastSystemTimings.emplace_back().name = system_type_name(typeid(T).name());
 
         system->init();
     }
 
+    // Queues an event from any thread. It becomes readable through events() on the next update
+    template <typename T, class... Args>
+    void emit(Args&&... args)
+    {
+        EventBus::getInstance().get_channel<T>().emit(std::forward<Args>(args)...);
+    }
+
+    // The events of the given type that were emitted during the previous update
+    template <typename T>
+    std::span<const T> events()
+    {
+        return EventBus::getInstance().get_channel<T>().events();
+    }
+
+    // Execution time statistics of every system, in the order that they are run
+    std::vector<const SystemTimings*> get_system_timings();
+    // Writes the system timings to a file, as JSON if the path ends in .json and as CSV otherwise
+    void dump_system_timings(const std::string& path);
+
+    // See ComponentView. Call on the thread that owns the ECS and hand the view to the workers
+    template <typename T>
+    ComponentView<T> view()
+    {
+        return ComponentView<T>(*entityData);
+    }
+
+    // Fills matches with the eid of every entity that has all of the component types provided by the template parameters
+    template <typename... Ts>
+    void query(std::vector<uint32_t>& matches)
+    {
+        static_assert(sizeof...(Ts) > 0, "A query needs at least one component type");
+
+        // No entity has a component of a type that was never registered, and a query shouldn't register one
+        ComponentGroup* groups[] = { entityData->find_component_group<Ts>()... };
+        ComponentMask signature;
+        for (ComponentGroup* cg : groups) {
+            if (cg == nullptr) {
+                matches.clear();
+                return;
+            }
+            signature.set(cg->cgid);
+        }
+
+        size_t insertPosition = entityData->entityInsertPosition.load(std::memory_order_acquire);
+        matches.resize(insertPosition);
+        matches.resize(match_signature(entityData->entityMasks, insertPosition, signature, matches.data()));
+    }
+
+    // Calls f with the entity once the given number of updates have run. Removing the entity cancels its timers
+    TimerHandle schedule(Entity e, uint64_t delayTicks, std::function<void(Entity&)> f);
+    // Returns false if the timer already fired or was cancelled
+    bool cancel_timer(TimerHandle handle);
+
+    void set_update_tier(Entity e, int tier);
+
+    // Assigns every entity with a component of the given type to an update tier based on a metric, such as its distance
+    // to the camera. Entities whose metric is below thresholds[0] go to tier 0, below thresholds[1] to tier 1 and so on.
+    // The rest go to tier thresholds.size().
+    template <typename T>
+    void assign_update_tiers(std::function<float(Entity&, T*)> metric, const std::vector<float>& thresholds)
+    {
+        each_component<T>([this, &metric, &thresholds](Entity& e, T* component) {
+            float value = metric(e, component);
+
+            size_t tier = 0;
+            while (tier < thresholds.size() && value >= thresholds[tier]) {
+                tier++;
+            }
+            set_update_tier(e, (int)tier);
+        });
+    }
+
+    // Like each_component(), but only runs the function on entities whose update tier is due this tick. Entities of a
+    // tier are spread evenly over the ticks of its period. dt_ms is scaled by the period of the entity's tier so that
+    // it covers all of the ticks since the entity was last processed.
+    template <typename T>
+    void each_component_tiered(double dt_ms, std::function<void(Entity&, T*, double)> f)
+    {
+        ComponentGroup* cg = entityData->find_component_group<T>();
+        if (cg == nullptr) {
+            return;
+        }
+        ComponentGroupData<T>* cgd = (ComponentGroupData<T>*)cg->cgd;
+
+        ScratchMatches scratch;
+        std::vector<uint32_t>& matches = scratch.get();
+        query<T>(matches);
+        for (uint32_t i : matches) {
+            uint64_t period = (uint64_t)1 << entityData->updateTiers[i];
+            if (((entityData->tick + entityData->updatePhases[i]) & (period - 1)) != 0) {
+                continue;
+            }
+
+            // f may have removed this entity or component since the query ran
+            if (entityData->entities[i].active && entityData->entityMasks[i].test(cg->cgid)) {
+                Entity e(i);
+                f(e, &cgd->components[i], dt_ms * period);
+            }
+        }
+    }
+
+    // Like each_component(), but starts at the entity at cursor and stops once the budget is exhausted. The cursor is
+    // left where it stopped so that the next call picks up from there. Returns true once a pass over every entity is
+    // finished, at which point the cursor is reset for the next pass. Compaction between calls may make the pass visit
+    // some entities twice, but never skips one.
+    template <typename T>
+    bool each_component_sliced(SliceCursor& cursor, const FrameBudget& budget, std::function<void(Entity&, T*)> f)
+    {
+        ComponentGroup* cg = entityData->find_component_group<T>();
+        if (cg == nullptr) {
+            cursor.position = 0;
+            return true;
+        }
+        ComponentGroupData<T>* cgd = (ComponentGroupData<T>*)cg->cgd;
+
+        size_t insertPosition = entityData->entityInsertPosition.load(std::memory_order_acquire);
+        size_t processed = 0;
+        while (cursor.position < insertPosition) {
+            size_t i = cursor.position;
+            if (entityData->entities[i].active && entityData->entityMasks[i].test(cg->cgid)) {
+                // Reading the clock can cost more than cheap per-entity work, so it is only checked every few entities.
+                // Not before the first one though, so that every call makes progress.
+                if (processed > 0 && processed % SLICE_BUDGET_CHECK_INTERVAL == 0 && budget.exhausted()) {
+                    return false;
+                }
+                processed++;
+
+                Entity e(i);
+                f(e, &cgd->components[i]);
+            }
+            cursor.position++;
+        }
+
+        cursor.position = 0;
+        return true;
+    }
+
     // Runs the given function on each component of the type provided by the template parameter.
     // Provides the entity associated with that component as well as the component itself.
     template <typename T>
     void each_component(std::function<void(Entity&, T*)> f)
     {
-        ComponentGroup* cg = entityData->get_component_group<T>();
+        ComponentGroup* cg = entityData->find_component_group<T>();
+        if (cg == nullptr) {
+            return;
+        }
         ComponentGroupData<T>* cgd = (ComponentGroupData<T>*)cg->cgd;
-        for (int i = 0; i < entityData->entityInsertPosition; ++i) {
-            // If the entity and component are both active
-            if (entityData->entities[i].active && entityData->entities[i].activeComponents.test(cg->cgid)) {
+
+        ScratchMatches scratch;
+        std::vector<uint32_t>& matches = scratch.get();
+        query<T>(matches);
+        for (uint32_t i : matches) {
+            // f may have removed this entity or component since the query ran
+            if (entityData->entities[i].active && entityData->entityMasks[i].test(cg->cgid)) {
                 Entity e(i);
                 f(e, &cgd->components[i]);
             }
@@ -222,6 +757,8 @@ public:
     void operator=(EntityManager const&) = delete;
 
 private:
+    void relocate_entity(size_t from, size_t to);
+
     EntityData* entityData = nullptr;
 };
 }
\ No newline at end of file
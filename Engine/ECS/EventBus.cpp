@@ -0,0 +1,31 @@
+#include "EventBus.hpp"
+
+using namespace ECS;
+
+EventBus& EventBus::getInstance()
+{
+    static EventBus bus;
+    return bus;
+}
+
+void EventBus::register_channel(EventChannelBase* channel)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_channels.push_back(channel);
+}
+
+void EventBus::swap()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (EventChannelBase* channel : m_channels) {
+        channel->swap();
+    }
+}
+
+void EventBus::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (EventChannelBase* channel : m_channels) {
+        channel->clear();
+    }
+}
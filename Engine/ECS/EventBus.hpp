@@ -0,0 +1,131 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace ECS {
+struct EventChannelBase {
+    // Makes the events emitted since the last swap readable and starts collecting new ones
+    virtual void swap() = 0;
+    virtual void clear() = 0;
+};
+
+// Events of a single type. Every emitting thread appends to its own buffer, so emitting only takes a lock the first
+// time a thread emits this type of event and when the thread exits. swap() must not run while other threads are still
+// emitting.
+template <typename T>
+class EventChannel : public EventChannelBase {
+public:
+    template <class... Args>
+    void emit(Args&&... args)
+    {
+        thread_local ThreadBuffer buffer;
+        if (buffer.pending == nullptr) {
+            buffer.channel = this;
+            buffer.pending = register_thread();
+        }
+
+        buffer.pending->emplace_back(std::forward<Args>(args)...);
+    }
+
+    std::span<const T> events() const
+    {
+        return m_current;
+    }
+
+    void swap() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_current.clear();
+        std::swap(m_current, m_exitedEvents);
+        for (auto& buffer : m_threadBuffers) {
+            if (m_current.empty()) {
+                // Keeps both allocations alive instead of copying when only one thread emitted anything
+                std::swap(m_current, *buffer);
+            } else {
+                m_current.insert(m_current.end(), std::make_move_iterator(buffer->begin()), std::make_move_iterator(buffer->end()));
+                buffer->clear();
+            }
+        }
+    }
+
+    void clear() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_current.clear();
+        m_exitedEvents.clear();
+        for (auto& buffer : m_threadBuffers) {
+            buffer->clear();
+        }
+    }
+
+private:
+    // Gives the buffer of a thread back to the channel when the thread exits, so that threads coming and going don't
+    // pile up buffers
+    struct ThreadBuffer {
+        ~ThreadBuffer()
+        {
+            if (pending != nullptr) {
+                channel->unregister_thread(pending);
+            }
+        }
+
+        EventChannel* channel = nullptr;
+        std::vector<T>* pending = nullptr;
+    };
+
+    std::vector<T>* register_thread()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threadBuffers.push_back(std::make_unique<std::vector<T>>());
+        return m_threadBuffers.back().get();
+    }
+
+    void unregister_thread(std::vector<T>* pending)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Whatever the thread emitted since the last swap still goes out with the next one
+        m_exitedEvents.insert(m_exitedEvents.end(), std::make_move_iterator(pending->begin()), std::make_move_iterator(pending->end()));
+        std::erase_if(m_threadBuffers, [pending](const auto& buffer) { return buffer.get() == pending; });
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<std::vector<T>>> m_threadBuffers;
+    // Events of threads that exited before the next swap
+    std::vector<T> m_exitedEvents;
+    // The events that were emitted before the last swap
+    std::vector<T> m_current;
+};
+
+// Singleton that keeps track of every event channel so that they can all be swapped at once
+struct EventBus {
+    template <typename T>
+    EventChannel<T>& get_channel()
+    {
+        // Same approach as EntityData::get_component_group(), one channel per type
+        static EventChannel<T> channel;
+        [[maybe_unused]] static bool registered = (register_channel(&channel), true);
+
+        return channel;
+    }
+
+    void register_channel(EventChannelBase* channel);
+    void swap();
+    void clear();
+
+    EventBus() { }
+
+    // Singleton class
+    static EventBus& getInstance();
+    EventBus(EventBus&) = delete;
+    void operator=(EventBus const&) = delete;
+
+private:
+    std::mutex m_mutex;
+    std::vector<EventChannelBase*> m_channels;
+};
+}
@@ -0,0 +1,49 @@
+#include "Prefab.hpp"
+
+using namespace ECS;
+
+Entity Prefab::instantiate()
+{
+    std::vector<uint32_t> eids;
+    instantiate(1, eids);
+    return Entity(eids.back());
+}
+
+void Prefab::instantiate(size_t count, std::vector<uint32_t>& eids)
+{
+    EntityData& entityData = EntityData::getInstance();
+
+    // Room for every eid up front, so that nothing but reserving a slot or cloning a component can throw below
+    size_t first = eids.size();
+    eids.reserve(first + count);
+
+    try {
+        for (size_t i = 0; i < count; ++i) {
+            eids.push_back((uint32_t)entityData.reserve_entity_slot());
+            // Set before the components are written, so that removing the instance on failure destroys them
+            entityData.entityMasks[eids.back()] = m_signature;
+        }
+
+        // One component type at a time so that each pass only writes to a single component array
+        for (const PrefabComponent& component : m_components) {
+            if (component.size > 0) {
+                char* components = (char*)component.cg->cgd;
+                for (size_t i = first; i < eids.size(); ++i) {
+                    memcpy(components + eids[i] * component.size, component.value.get(), component.size);
+                }
+            } else {
+                for (size_t i = first; i < eids.size(); ++i) {
+                    component.clone(component.value.get(), component.cg->cgd, eids[i]);
+                }
+            }
+        }
+    } catch (...) {
+        // Running out of entity slots partway through would otherwise leave the ones reserved so far active
+        EntityManager em;
+        for (size_t i = first; i < eids.size(); ++i) {
+            em.remove_entity(Entity(eids[i]));
+        }
+        eids.resize(first);
+        throw;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <ECS/ECS.hpp>
+
+namespace ECS {
+// A template for entities with a fixed set of components and initial values. Component types are looked up once when
+// the prefab is built, so instantiating it goes straight to the component storage. Trivially copyable components are
+// copied with memcpy, anything else is copy-assigned or cloned with a hook set through set_clone_hook().
+// Instances are unnamed, like entities created with EntityManager::reserve_entity(). EntityManager::clear()
+// invalidates every prefab, EntityManager::reset() does not.
+class Prefab {
+public:
+    template <typename T, class... Args>
+    Prefab& add(Args&&... args)
+    {
+        ComponentGroup* cg = EntityData::getInstance().get_component_group<T>();
+        if (m_signature.test(cg->cgid)) {
+            throw std::runtime_error("This prefab already has the given component type");
+        }
+
+        PrefabComponent component;
+        component.cg = cg;
+        component.value = std::make_shared<T>(std::forward<Args>(args)...);
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            component.size = sizeof(T);
+        } else {
+            component.clone = [](const void* source, void* cgd, size_t eid) {
+                ((ComponentGroupData<T>*)cgd)->components[eid] = *(const T*)source;
+            };
+        }
+
+        m_components.push_back(component);
+        m_signature.set(cg->cgid);
+
+        return *this;
+    }
+
+    // Overrides how the prefab's component of type T is copied into an instance, for components that own resources
+    // that can't simply be shared between copies
+    template <typename T>
+    Prefab& set_clone_hook(std::function<void(const T& source, T& destination)> hook)
+    {
+        ComponentGroup* cg = EntityData::getInstance().get_component_group<T>();
+        for (PrefabComponent& component : m_components) {
+            if (component.cg == cg) {
+                component.size = 0;
+                component.clone = [hook](const void* source, void* cgd, size_t eid) {
+                    hook(*(const T*)source, ((ComponentGroupData<T>*)cgd)->components[eid]);
+                };
+                return *this;
+            }
+        }
+
+        throw std::runtime_error("Cannot set a clone hook for a component the prefab doesn't have");
+    }
+
+    Entity instantiate();
+    // Creates count instances and appends their eids to eids
+    void instantiate(size_t count, std::vector<uint32_t>& eids);
+
+private:
+    struct PrefabComponent {
+        ComponentGroup* cg = nullptr;
+        std::shared_ptr<void> value;
+
+        // Non-zero if the component can be copied with memcpy, otherwise clone is used
+        size_t size = 0;
+        std::function<void(const void* source, void* cgd, size_t eid)> clone;
+    };
+
+    std::vector<PrefabComponent> m_components;
+    ComponentMask m_signature;
+};
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <bitset>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <ECS/ECS.hpp>
+
+namespace ECS {
+// Position of T in the parameter pack Ts
+template <typename T, typename... Ts>
+struct TypeIndex;
+
+template <typename T, typename... Ts>
+struct TypeIndex<T, T, Ts...> : std::integral_constant<size_t, 0> {
+};
+
+template <typename T, typename U, typename... Ts>
+struct TypeIndex<T, U, Ts...> : std::integral_constant<size_t, 1 + TypeIndex<T, Ts...>::value> {
+};
+
+// Entity storage for a set of component types that is known at compile time. Unlike EntityData there is no runtime
+// type registration: the pool for a type is found in a std::tuple with an index computed at compile time, so
+// component access compiles down to indexing into a typed array.
+template <typename... Components>
+class StaticWorld {
+public:
+    using Mask = std::bitset<sizeof...(Components)>;
+
+    StaticWorld()
+        : m_pools(std::make_unique<ComponentGroupData<Components>>()...)
+        , m_masks(MAX_ENTITIES)
+        , m_active(MAX_ENTITIES, false)
+    {
+    }
+
+    template <typename T>
+    static constexpr size_t type_index()
+    {
+        static_assert((std::is_same_v<T, Components> || ...), "Component type is not part of this StaticWorld");
+        return TypeIndex<T, Components...>::value;
+    }
+
+    size_t add_entity()
+    {
+        size_t eid = 0;
+        if (m_freeSlots.size() > 0) {
+            eid = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        } else if (m_insertPosition < MAX_ENTITIES) {
+            eid = m_insertPosition++;
+        } else {
+            throw std::runtime_error("Tried to insert more than MAX_ENTITIES");
+        }
+
+        m_active[eid] = true;
+        return eid;
+    }
+
+    void remove_entity(size_t eid)
+    {
+        m_active[eid] = false;
+        m_masks[eid].reset();
+        m_freeSlots.push_back(eid);
+    }
+
+    template <typename T, class... Args>
+    T& add_component(size_t eid, Args&&... args)
+    {
+        if (m_masks[eid].test(type_index<T>())) {
+            throw std::runtime_error("This entity already has the given component type");
+        }
+
+        T& component = pool<T>().components[eid];
+        component = T(std::forward<Args>(args)...);
+        m_masks[eid].set(type_index<T>());
+        return component;
+    }
+
+    template <typename T>
+    bool has_component(size_t eid)
+    {
+        return m_masks[eid].test(type_index<T>());
+    }
+
+    // Returns nullptr if the entity doesn't have the component
+    template <typename T>
+    T* get_component(size_t eid)
+    {
+        return has_component<T>(eid) ? &pool<T>().components[eid] : nullptr;
+    }
+
+    template <typename T>
+    void remove_component(size_t eid)
+    {
+        if (!m_masks[eid].test(type_index<T>())) {
+            throw std::runtime_error("Cannot remove component that has not been added");
+        }
+
+        m_masks[eid].reset(type_index<T>());
+    }
+
+    // Calls f(eid, components...) for every entity that has all of the given component types
+    template <typename... Ts, typename F>
+    void each(F&& f)
+    {
+        Mask signature;
+        (signature.set(type_index<Ts>()), ...);
+
+        for (size_t i = 0; i < m_insertPosition; ++i) {
+            if (m_active[i] && (m_masks[i] & signature) == signature) {
+                f(i, pool<Ts>().components[i]...);
+            }
+        }
+    }
+
+private:
+    template <typename T>
+    ComponentGroupData<T>& pool()
+    {
+        return *std::get<type_index<T>()>(m_pools);
+    }
+
+    std::tuple<std::unique_ptr<ComponentGroupData<Components>>...> m_pools;
+
+    std::vector<Mask> m_masks;
+    std::vector<bool> m_active;
+
+    size_t m_insertPosition = 0;
+    std::vector<size_t> m_freeSlots;
+};
+}
@@ -0,0 +1,90 @@
+#include "SystemTimings.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+using namespace ECS;
+
+size_t SystemTimings::sample_count() const
+{
+    return (size_t)std::min<uint64_t>(callCount, SYSTEM_TIMING_WINDOW);
+}
+
+double SystemTimings::min_ms() const
+{
+    size_t count = sample_count();
+    return count == 0 ? 0.0 : *std::min_element(samples, samples + count);
+}
+
+double SystemTimings::avg_ms() const
+{
+    size_t count = sample_count();
+    if (count == 0) {
+        return 0.0;
+    }
+
+    double total = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        total += samples[i];
+    }
+    return total / count;
+}
+
+double SystemTimings::max_ms() const
+{
+    size_t count = sample_count();
+    return count == 0 ? 0.0 : *std::max_element(samples, samples + count);
+}
+
+double SystemTimings::p99_ms() const
+{
+    size_t count = sample_count();
+    if (count == 0) {
+        return 0.0;
+    }
+
+    std::vector<float> sorted(samples, samples + count);
+    size_t rank = (count * 99 + 99) / 100 - 1;
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+std::string ECS::system_type_name(const char* mangledName)
+{
+#if defined(__GNUG__)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangledName, nullptr, nullptr, &status);
+    if (status == 0 && demangled != nullptr) {
+        std::string name = demangled;
+        std::free(demangled);
+        return name;
+    }
+#endif
+    return mangledName;
+}
+
+void ECS::write_system_timings_csv(std::ostream& out, const std::vector<const SystemTimings*>& timings)
+{
+    out << "system,calls,min_ms,avg_ms,max_ms,p99_ms\n";
+    for (const SystemTimings* t : timings) {
+        out << t->name << ',' << t->callCount << ',' << t->min_ms() << ',' << t->avg_ms() << ','
+            << t->max_ms() << ',' << t->p99_ms() << '\n';
+    }
+}
+
+void ECS::write_system_timings_json(std::ostream& out, const std::vector<const SystemTimings*>& timings)
+{
+    out << "[\n";
+    for (size_t i = 0; i < timings.size(); ++i) {
+        const SystemTimings* t = timings[i];
+        out << "  { \"system\": \"" << t->name << "\", \"calls\": " << t->callCount
+            << ", \"min_ms\": " << t->min_ms() << ", \"avg_ms\": " << t->avg_ms()
+            << ", \"max_ms\": " << t->max_ms() << ", \"p99_ms\": " << t->p99_ms() << " }"
+            << (i + 1 < timings.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+}
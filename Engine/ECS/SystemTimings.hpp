@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ECS {
+// The number of most recent updates that the rolling statistics of a system cover
+constexpr int SYSTEM_TIMING_WINDOW = 256;
+
+// Execution time statistics for a single system. Recording a sample only stores it in a ring buffer, the
+// statistics are computed from the ring buffer when they are queried.
+struct SystemTimings {
+    void record(double ms)
+    {
+        samples[callCount % SYSTEM_TIMING_WINDOW] = (float)ms;
+        callCount++;
+    }
+
+    double min_ms() const;
+    double avg_ms() const;
+    double max_ms() const;
+    double p99_ms() const;
+
+    std::string name;
+    uint64_t callCount = 0;
+    float samples[SYSTEM_TIMING_WINDOW] = {};
+
+private:
+    size_t sample_count() const;
+};
+
+// Readable name for a system type, used to label its timings
+std::string system_type_name(const char* mangledName);
+
+void write_system_timings_csv(std::ostream& out, const std::vector<const SystemTimings*>& timings);
+void write_system_timings_json(std::ostream& out, const std::vector<const SystemTimings*>& timings);
+}
@@ -0,0 +1,200 @@
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+
+using namespace ECS;
+
+TimerWheel::TimerWheel(size_t maxEntities)
+    : m_entityTimers(maxEntities, NIL)
+{
+    std::fill(std::begin(m_slots), std::end(m_slots), NIL);
+}
+
+TimerHandle TimerWheel::schedule(uint32_t eid, uint64_t delayTicks, std::function<void(size_t eid)> callback)
+{
+    uint32_t index;
+    if (m_freeNodes.size() > 0) {
+        index = m_freeNodes.back();
+        m_freeNodes.pop_back();
+    } else {
+        index = (uint32_t)m_nodes.size();
+        m_nodes.emplace_back();
+    }
+
+    Node& node = m_nodes[index];
+    node.due = m_tick + std::max<uint64_t>(delayTicks, 1);
+    node.eid = eid;
+    node.callback = std::move(callback);
+
+    if (eid != NO_ENTITY) {
+        node.entityPrev = NIL;
+        node.entityNext = m_entityTimers[eid];
+        if (node.entityNext != NIL) {
+            m_nodes[node.entityNext].entityPrev = index;
+        }
+        m_entityTimers[eid] = index;
+    }
+
+    insert(index);
+
+    return { index, node.generation };
+}
+
+bool TimerWheel::cancel(TimerHandle handle)
+{
+    if (handle.index >= m_nodes.size()) {
+        return false;
+    }
+
+    Node& node = m_nodes[handle.index];
+    if (node.generation != handle.generation || node.slot == FREE) {
+        return false;
+    }
+
+    // Timers that are about to fire are skipped because release() changes their generation
+    if (node.slot != FIRING) {
+        unlink(handle.index);
+    }
+    release(handle.index);
+
+    return true;
+}
+
+void TimerWheel::cancel_entity(uint32_t eid)
+{
+    while (m_entityTimers[eid] != NIL) {
+        uint32_t index = m_entityTimers[eid];
+        cancel({ index, m_nodes[index].generation });
+    }
+}
+
+void TimerWheel::relocate_entity(uint32_t from, uint32_t to)
+{
+    m_entityTimers[to] = m_entityTimers[from];
+    m_entityTimers[from] = NIL;
+
+    for (uint32_t index = m_entityTimers[to]; index != NIL; index = m_nodes[index].entityNext) {
+        m_nodes[index].eid = to;
+    }
+}
+
+void TimerWheel::advance()
+{
+    m_tick++;
+
+    // When a level wraps around, the timers in the next slot of the level above are now close enough to move down
+    for (int level = 1; level < LEVELS; ++level) {
+        if ((m_tick & ((1ull << (SLOT_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        cascade(level);
+    }
+
+    // Detach the due timers first, since the callbacks may schedule or cancel timers
+    uint32_t& head = m_slots[m_tick & (SLOTS - 1)];
+    for (uint32_t index = head; index != NIL; index = m_nodes[index].next) {
+        m_nodes[index].slot = FIRING;
+        m_firing.push_back({ index, m_nodes[index].generation });
+    }
+    head = NIL;
+
+    for (auto [index, generation] : m_firing) {
+        Node& node = m_nodes[index];
+        if (node.generation != generation || node.slot != FIRING) {
+            continue;
+        }
+
+        std::function<void(size_t)> callback = std::move(node.callback);
+        uint32_t eid = node.eid;
+        release(index);
+
+        callback(eid);
+    }
+    m_firing.clear();
+}
+
+void TimerWheel::clear()
+{
+    for (uint32_t index = 0; index < m_nodes.size(); ++index) {
+        if (m_nodes[index].slot != FREE) {
+            release(index);
+        }
+    }
+    std::fill(std::begin(m_slots), std::end(m_slots), NIL);
+}
+
+void TimerWheel::insert(uint32_t index)
+{
+    Node& node = m_nodes[index];
+    uint64_t delta = node.due - m_tick;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    // Timers past the range of the top level are parked in its furthest slot and re-inserted from there
+    uint64_t slotTick = node.due;
+    if (delta >= (1ull << (SLOT_BITS * LEVELS))) {
+        slotTick = m_tick + (1ull << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    uint32_t slot = level * SLOTS + ((slotTick >> (SLOT_BITS * level)) & (SLOTS - 1));
+    node.slot = slot;
+    node.prev = NIL;
+    node.next = m_slots[slot];
+    if (node.next != NIL) {
+        m_nodes[node.next].prev = index;
+    }
+    m_slots[slot] = index;
+}
+
+void TimerWheel::unlink(uint32_t index)
+{
+    Node& node = m_nodes[index];
+    if (node.prev != NIL) {
+        m_nodes[node.prev].next = node.next;
+    } else {
+        m_slots[node.slot] = node.next;
+    }
+    if (node.next != NIL) {
+        m_nodes[node.next].prev = node.prev;
+    }
+}
+
+// Frees a node that has already been taken out of its slot list
+void TimerWheel::release(uint32_t index)
+{
+    Node& node = m_nodes[index];
+    if (node.eid != NO_ENTITY) {
+        if (node.entityPrev != NIL) {
+            m_nodes[node.entityPrev].entityNext = node.entityNext;
+        } else {
+            m_entityTimers[node.eid] = node.entityNext;
+        }
+        if (node.entityNext != NIL) {
+            m_nodes[node.entityNext].entityPrev = node.entityPrev;
+        }
+    }
+
+    node.slot = FREE;
+    node.eid = NO_ENTITY;
+    node.entityPrev = NIL;
+    node.entityNext = NIL;
+    node.callback = nullptr;
+    node.generation++;
+    m_freeNodes.push_back(index);
+}
+
+void TimerWheel::cascade(int level)
+{
+    uint32_t& head = m_slots[level * SLOTS + ((m_tick >> (SLOT_BITS * level)) & (SLOTS - 1))];
+    uint32_t index = head;
+    head = NIL;
+
+    while (index != NIL) {
+        uint32_t next = m_nodes[index].next;
+        insert(index);
+        index = next;
+    }
+}
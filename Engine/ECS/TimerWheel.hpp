@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace ECS {
+struct TimerHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+// Hierarchical timing wheel. Level 0 has one slot per tick for the next 256 ticks, and every level above it covers
+// 256 times the range of the one below. A timer is put in the lowest level whose range reaches its due tick, and
+// it moves down a level each time the level below wraps around to the slot it's in. Scheduling and cancelling are
+// O(1), and advancing a tick only touches the timers that are due or moving down a level.
+class TimerWheel {
+public:
+    static constexpr uint32_t NO_ENTITY = UINT32_MAX;
+
+    TimerWheel(size_t maxEntities);
+
+    // Calls callback with eid once delayTicks ticks have passed. A delay of 0 is treated as 1.
+    // Timers scheduled for an entity can all be cancelled at once with cancel_entity()
+    TimerHandle schedule(uint32_t eid, uint64_t delayTicks, std::function<void(size_t eid)> callback);
+    // Returns false if the timer already fired or was cancelled
+    bool cancel(TimerHandle handle);
+    void cancel_entity(uint32_t eid);
+    // Moves the timers of an entity over to a new eid
+    void relocate_entity(uint32_t from, uint32_t to);
+
+    // Moves forward one tick and fires every timer that is due
+    void advance();
+    void clear();
+
+    uint64_t current_tick() { return m_tick; }
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+
+    static constexpr uint32_t NIL = UINT32_MAX;
+    // Values of Node::slot for timers that aren't in any slot
+    static constexpr uint32_t FREE = UINT32_MAX;
+    static constexpr uint32_t FIRING = UINT32_MAX - 1;
+
+    struct Node {
+        uint64_t due = 0;
+        uint32_t eid = NO_ENTITY;
+        // Bumped whenever the node is released so that stale handles can be detected
+        uint32_t generation = 0;
+
+        // Index into m_slots of the list this node is in, or FREE or FIRING
+        uint32_t slot = FREE;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+
+        // Links between the timers of the same entity
+        uint32_t entityPrev = NIL;
+        uint32_t entityNext = NIL;
+
+        std::function<void(size_t)> callback;
+    };
+
+    void insert(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(int level);
+
+    uint64_t m_tick = 0;
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_freeNodes;
+
+    // Head of the timer list of every slot of every level
+    uint32_t m_slots[LEVELS * SLOTS];
+    // Head of the timer list of every entity, indexed by eid
+    std::vector<uint32_t> m_entityTimers;
+
+    // Timers taken out of the current level 0 slot to be fired, with the generation they had at the time
+    std::vector<std::pair<uint32_t, uint32_t>> m_firing;
+};
+}
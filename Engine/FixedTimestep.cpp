@@ -0,0 +1,44 @@
+#include "FixedTimestep.hpp"
+
+FixedTimestep::FixedTimestep(double tickRate, int maxTicksPerFrame)
+    : m_tick_ms(1000.0 / tickRate)
+    , m_maxTicksPerFrame(maxTicksPerFrame)
+{
+}
+
+void FixedTimestep::begin_frame()
+{
+    Clock::time_point now = Clock::now();
+    if (!m_started) {
+        m_lastFrame = now;
+        m_started = true;
+    }
+
+    m_accumulator_ms += std::chrono::duration<double, std::milli>(now - m_lastFrame).count();
+    m_lastFrame = now;
+
+    // Drop whatever time can't be caught up on this frame instead of carrying it over
+    if (m_accumulator_ms > m_maxTicksPerFrame * m_tick_ms) {
+        m_accumulator_ms = m_maxTicksPerFrame * m_tick_ms;
+    }
+}
+
+bool FixedTimestep::step()
+{
+    if (m_accumulator_ms < m_tick_ms) {
+        return false;
+    }
+
+    m_accumulator_ms -= m_tick_ms;
+    return true;
+}
+
+void TransformHistory::update(double dt_ms)
+{
+    ECS::EntityManager em;
+    em.query<Transform, PreviousTransform>(m_matches);
+    for (uint32_t eid : m_matches) {
+        ECS::Entity e(eid);
+        e.get_component<PreviousTransform>().value()->transform = *e.get_component<Transform>().value();
+    }
+}
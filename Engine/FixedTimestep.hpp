@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+
+#include <ECS/ECS.hpp>
+#include <Transform.hpp>
+
+// Runs the simulation at a fixed rate no matter how fast frames are rendered. Call begin_frame() once per frame,
+// then run one simulation tick of tick_ms() for every time step() returns true. Afterwards alpha() tells how far
+// real time has moved between the last tick and the next one, for interpolating what gets rendered.
+class FixedTimestep {
+public:
+    FixedTimestep(double tickRate = 60.0, int maxTicksPerFrame = 5);
+
+    void begin_frame();
+    bool step();
+
+    double tick_ms() { return m_tick_ms; }
+    float alpha() { return (float)(m_accumulator_ms / m_tick_ms); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double m_tick_ms;
+    // Caps how many ticks a single frame can run so that a long stall doesn't snowball into ever longer frames
+    int m_maxTicksPerFrame;
+
+    double m_accumulator_ms = 0.0;
+    Clock::time_point m_lastFrame;
+    bool m_started = false;
+};
+
+// Copies each entity's Transform to its PreviousTransform at the start of a tick. Add it before any system that
+// moves entities.
+class TransformHistory : public ECS::System {
+public:
+    void init() override { }
+    void update(double dt_ms) override;
+    void exit() override { }
+
+private:
+    std::vector<uint32_t> m_matches;
+};
@@ -0,0 +1,109 @@
+#include "JobSystem.hpp"
+
+#include <algorithm>
+#include <utility>
+
+JobSystem::JobSystem(size_t workerCount)
+{
+    if (workerCount == 0) {
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 1; i < workerCount; ++i) {
+        m_threads.emplace_back(&JobSystem::worker_main, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void JobSystem::parallel_for(size_t count, size_t minBatch, const std::function<void(size_t, size_t, size_t)>& f)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Not worth waking anyone for a single batch
+    size_t batchSize = std::max(minBatch, (count + worker_count() - 1) / worker_count());
+    if (m_threads.empty() || batchSize >= count) {
+        f(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &f;
+        m_count = count;
+        m_batchSize = batchSize;
+        m_nextBatch.store(0, std::memory_order_relaxed);
+        m_failed.store(false, std::memory_order_relaxed);
+        m_busyWorkers = m_threads.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    run_batches(0);
+
+    // Even if f threw on this thread, since the workers may still be calling it
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_busyWorkers == 0; });
+    m_job = nullptr;
+
+    if (m_exception) {
+        std::exception_ptr exception = std::exchange(m_exception, nullptr);
+        lock.unlock();
+        std::rethrow_exception(exception);
+    }
+}
+
+void JobSystem::worker_main(size_t worker)
+{
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_quit || m_generation != seenGeneration; });
+            if (m_quit) {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+
+        run_batches(worker);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0) {
+            m_done.notify_one();
+        }
+    }
+}
+
+void JobSystem::run_batches(size_t worker)
+{
+    while (!m_failed.load(std::memory_order_relaxed)) {
+        size_t begin = m_nextBatch.fetch_add(1, std::memory_order_relaxed) * m_batchSize;
+        if (begin >= m_count) {
+            return;
+        }
+
+        try {
+            (*m_job)(begin, std::min(begin + m_batchSize, m_count), worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_exception) {
+                m_exception = std::current_exception();
+            }
+            m_failed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
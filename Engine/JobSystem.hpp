@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that split loops between them. The calling thread takes part as worker 0, so
+// worker_count() is the number of background threads plus one.
+class JobSystem {
+public:
+    // 0 picks one worker per hardware thread
+    JobSystem(size_t workerCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    size_t worker_count() const { return m_threads.size() + 1; }
+
+    // Calls f(begin, end, worker) over batches of at least minBatch items covering [0, count) and returns once all
+    // of them are done. Only one parallel_for can run at a time. If f throws, the batches that haven't started are
+    // skipped and the first exception is rethrown once every worker has stopped.
+    void parallel_for(size_t count, size_t minBatch, const std::function<void(size_t, size_t, size_t)>& f);
+
+private:
+    void worker_main(size_t worker);
+    void run_batches(size_t worker);
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    size_t m_busyWorkers = 0;
+    bool m_quit = false;
+
+    const std::function<void(size_t, size_t, size_t)>* m_job = nullptr;
+    size_t m_count = 0;
+    size_t m_batchSize = 0;
+    std::atomic<size_t> m_nextBatch;
+    // The first exception thrown by the current job, guarded by m_mutex
+    std::exception_ptr m_exception;
+    std::atomic<bool> m_failed = false;
+};
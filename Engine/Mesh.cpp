@@ -1,5 +1,9 @@
 #include "Mesh.hpp"
 
+#include <atomic>
+#include <stdexcept>
+
+#include <MeshProcessing.hpp>
 #include <Renderer/Renderer.hpp>
 #include <Renderer/VulkanInitializers.hpp>
 
@@ -39,44 +43,165 @@ VertexInputDescription Vertex::get_vertex_description()
     return description;
 }
 
-const std::vector<Vertex>& Mesh::getVertices()
+VertexInputDescription QuantizedVertex::get_vertex_description()
 {
-    return m_vertices;
+    VertexInputDescription description;
+
+    VkVertexInputBindingDescription mainBinding {};
+    mainBinding.binding = 0;
+    mainBinding.stride = sizeof(QuantizedVertex);
+    mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    description.bindings.push_back(mainBinding);
+
+    // Three component 16 bit formats are rarely supported for vertex input, hence the padding
+    VkVertexInputAttributeDescription positionAttribute {};
+    positionAttribute.binding = 0;
+    positionAttribute.location = 0;
+    positionAttribute.format = VK_FORMAT_R16G16B16A16_SNORM;
+    positionAttribute.offset = offsetof(QuantizedVertex, pos);
+
+    VkVertexInputAttributeDescription normalAttribute = {};
+    normalAttribute.binding = 0;
+    normalAttribute.location = 1;
+    normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+    normalAttribute.offset = offsetof(QuantizedVertex, norm);
+
+    VkVertexInputAttributeDescription colorAttribute = {};
+    colorAttribute.binding = 0;
+    colorAttribute.location = 2;
+    colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+    colorAttribute.offset = offsetof(QuantizedVertex, color);
+
+    description.attributes.push_back(positionAttribute);
+    description.attributes.push_back(normalAttribute);
+    description.attributes.push_back(colorAttribute);
+
+    return description;
 }
 
-void Mesh::set_vertices(std::vector<Vertex> vertices)
+VertexInputDescription get_vertex_description(VertexLayout layout)
 {
-    m_vertices = vertices;
-    upload();
+    switch (layout) {
+    case VertexLayout::Quantized:
+        return QuantizedVertex::get_vertex_description();
+    default:
+        return Vertex::get_vertex_description();
+    }
 }
 
-void Mesh::cleanup()
+size_t get_vertex_size(VertexLayout layout)
 {
-    if (m_buffer.inUse) {
-        vmaDestroyBuffer(*m_buffer.allocator, m_buffer.buffer, m_buffer.allocation);
+    switch (layout) {
+    case VertexLayout::Quantized:
+        return sizeof(QuantizedVertex);
+    default:
+        return sizeof(Vertex);
     }
 }
 
-void Mesh::upload()
+MeshData::~MeshData()
 {
-    if (m_buffer.inUse) {
-        vmaDestroyBuffer(m_globalData->allocator, m_buffer.buffer, m_buffer.allocation);
+    // Frames still in flight may be drawing from the ranges
+    if (vertexRange.valid() || indexRange.valid()) {
+        GlobalRenderContext* context = globalData.get();
+        GeometryAllocation vertices = vertexRange;
+        GeometryAllocation indices = indexRange;
+        size_t arena = (size_t)layout;
+        globalData->destroy_later([context, vertices, indices, arena]() {
+            context->vertexArenas[arena].free(vertices);
+            context->indexArena.free(indices);
+        });
     }
+}
+
+const std::vector<Vertex>& Mesh::getVertices()
+{
+    return m_data->vertices;
+}
+
+const std::vector<uint32_t>& Mesh::getIndices()
+{
+    return m_data->indices;
+}
+
+void Mesh::set_vertices(std::vector<Vertex> vertices, VertexLayout layout)
+{
+    std::vector<Vertex> unique;
+    std::vector<uint32_t> indices;
+    deduplicate_vertices(vertices, unique, indices);
+
+    set_indexed_vertices(std::move(unique), std::move(indices), layout);
+}
+
+void Mesh::set_indexed_vertices(std::vector<Vertex> vertices, std::vector<uint32_t> indices, VertexLayout layout)
+{
+    static std::atomic<uint64_t> nextId = 1;
 
-    m_buffer = create_buffer(
-        &m_globalData->allocator,
-        m_vertices.size() * sizeof(Vertex),
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    // The optimisations below index with these unchecked
+    if (indices.size() % 3 != 0) {
+        throw std::runtime_error("Mesh indices must form a triangle list");
+    }
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            throw std::runtime_error("Mesh index out of range of its vertices");
+        }
+    }
+
+    optimize_vertex_cache(indices, vertices.size());
+    optimize_vertex_fetch(vertices, indices);
+
+    auto data = std::make_shared<MeshData>();
+    data->globalData = m_globalData;
+    data->id = nextId++;
+    data->vertices = std::move(vertices);
+    data->indices = std::move(indices);
+    data->layout = layout;
+
+    AABB& bounds = data->bounds;
+    if (!data->vertices.empty()) {
+        bounds = { data->vertices[0].pos, data->vertices[0].pos };
+        for (const Vertex& vertex : data->vertices) {
+            bounds.min = glm::min(bounds.min, vertex.pos);
+            bounds.max = glm::max(bounds.max, vertex.pos);
+        }
+    }
 
-    void* data;
+    // Centered on the box, which is not the tightest sphere but is cheap and close for most meshes
+    data->boundingSphere = { bounds.center(), 0.0f };
+    for (const Vertex& vertex : data->vertices) {
+        data->boundingSphere.radius = std::max(data->boundingSphere.radius, glm::length(vertex.pos - data->boundingSphere.center));
+    }
+
+    if (!data->indices.empty()) {
+        upload(*data);
+    }
 
-    vmaMapMemory(m_globalData->allocator, m_buffer.allocation, &data);
+    m_data = data;
+}
 
-    memcpy(data, m_vertices.data(), m_vertices.size() * sizeof(Vertex));
+void Mesh::cleanup()
+{
+    m_data = std::make_shared<MeshData>();
+}
 
-    vmaUnmapMemory(m_globalData->allocator, m_buffer.allocation);
+void Mesh::upload(MeshData& data)
+{
+    GeometryArena& vertexArena = m_globalData->vertexArenas[(size_t)data.layout];
+    GeometryArena& indexArena = m_globalData->indexArena;
+    data.vertexRange = vertexArena.allocate((uint32_t)data.vertices.size());
+    data.indexRange = indexArena.allocate((uint32_t)data.indices.size());
+
+    std::vector<QuantizedVertex> quantized;
+    const void* vertices = data.vertices.data();
+    if (data.layout == VertexLayout::Quantized) {
+        data.dequantize = quantize_vertices(data.vertices, data.bounds, quantized);
+        vertices = quantized.data();
+    }
 
-    m_buffer.allocator = &m_globalData->allocator;
-    m_buffer.inUse = true;
-}
\ No newline at end of file
+    // Lands in device-local memory before the next frame draws
+    m_globalData->uploads.upload(vertexArena.get_buffer(data.vertexRange.block), vertexArena.get_byte_offset(data.vertexRange),
+        vertices, vertexArena.get_byte_size(data.vertexRange));
+    m_globalData->uploads.upload(indexArena.get_buffer(data.indexRange.block), indexArena.get_byte_offset(data.indexRange),
+        data.indices.data(), indexArena.get_byte_size(data.indexRange));
+}
@@ -1,12 +1,14 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include <ThirdParty/glm/glm.hpp>
 #include <ThirdParty/vk_mem_alloc.h>
 #include <vulkan/vulkan.h>
 
-#include <Renderer/VulkanTypes.hpp>
+#include <Bounds.hpp>
+#include <Renderer/GeometryArena.hpp>
 
 struct VertexInputDescription {
     std::vector<VkVertexInputBindingDescription> bindings;
@@ -23,28 +25,87 @@ struct Vertex {
     static VertexInputDescription get_vertex_description();
 };
 
-class GlobalRenderContext;
+// 16 bytes instead of 36. The position is snorm16 within the mesh's bounds, the normal is octahedral encoded in two
+// snorm16 and the color is RGBA8.
+struct QuantizedVertex {
+    int16_t pos[4];
+    int16_t norm[2];
+    uint8_t color[4];
+
+    static VertexInputDescription get_vertex_description();
+};
+
+// How the vertices of a mesh are stored on the GPU, picked when the mesh is uploaded. Each layout has its own
+// pipeline and vertex arena.
+enum class VertexLayout {
+    Float,
+    Quantized
+};
+
+const size_t VERTEX_LAYOUT_COUNT = 2;
+
+VertexInputDescription get_vertex_description(VertexLayout layout);
+size_t get_vertex_size(VertexLayout layout);
+
+struct GlobalRenderContext;
+
+// Indexed geometry of a mesh and where it was uploaded to. Copies of a Mesh share one MeshData, which is what lets the
+// renderer draw all entities holding copies of the same mesh with a single instanced draw. The vertices are freed
+// from the arenas with the last copy.
+struct MeshData {
+    ~MeshData();
+
+    std::shared_ptr<GlobalRenderContext> globalData;
+
+    // Unique for every set_vertices call, unlike the address which may be reused
+    uint64_t id = 0;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // Local space bounds of the vertices
+    AABB bounds;
+    Sphere boundingSphere;
+
+    VertexLayout layout = VertexLayout::Float;
+    // Takes quantized positions back to local space, identity for the float layout
+    glm::mat4 dequantize = glm::mat4(1.0f);
+
+    // Ranges of GlobalRenderContext::vertexArenas[layout] and indexArena, invalid while there are no triangles
+    GeometryAllocation vertexRange;
+    GeometryAllocation indexRange;
+};
 
 class Mesh {
 public:
     Mesh(std::shared_ptr<GlobalRenderContext> globalData)
         : m_globalData(globalData)
+        , m_data(std::make_shared<MeshData>())
     {
     }
 
     const std::vector<Vertex>& getVertices();
-    void set_vertices(std::vector<Vertex> vertices);
+    const std::vector<uint32_t>& getIndices();
+    // Replaces the geometry of this mesh only, copies made before keep drawing the old one. Takes a triangle list,
+    // whose repeated vertices are merged into an indexed mesh. The vertices are converted to layout for the GPU,
+    // getVertices keeps returning them at full precision.
+    void set_vertices(std::vector<Vertex> vertices, VertexLayout layout = VertexLayout::Float);
+    // Same, for geometry that is already indexed. Throws if the indices aren't a triangle list into vertices
+    void set_indexed_vertices(std::vector<Vertex> vertices, std::vector<uint32_t> indices, VertexLayout layout = VertexLayout::Float);
+
+    const AABB& get_bounds() const { return m_data->bounds; }
+    const Sphere& get_bounding_sphere() const { return m_data->boundingSphere; }
+
+    // Same for every copy of this mesh
+    const MeshData* get_data() const { return m_data.get(); }
 
     void cleanup();
 
 private:
-    void upload();
+    void upload(MeshData& data);
 
     std::shared_ptr<GlobalRenderContext> m_globalData;
+    std::shared_ptr<MeshData> m_data;
 
-    std::vector<Vertex> m_vertices;
-
-    AllocatedBuffer m_buffer;
     friend class PresentPass;
     friend struct RenderObject;
 };
\ No newline at end of file
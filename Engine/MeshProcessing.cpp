@@ -0,0 +1,248 @@
+#include "MeshProcessing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+void deduplicate_vertices(const std::vector<Vertex>& triangles, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    vertices.clear();
+    indices.clear();
+    indices.reserve(triangles.size());
+
+    // Keyed by the vertex bytes, which stay put since triangles isn't modified
+    std::unordered_map<std::string_view, uint32_t> unique;
+    unique.reserve(triangles.size());
+
+    for (const Vertex& vertex : triangles) {
+        std::string_view key((const char*)&vertex, sizeof(Vertex));
+        auto [it, inserted] = unique.try_emplace(key, (uint32_t)vertices.size());
+        if (inserted) {
+            vertices.push_back(vertex);
+        }
+        indices.push_back(it->second);
+    }
+}
+
+namespace {
+const int VERTEX_CACHE_SIZE = 32;
+
+// Vertex scores from Forsyth's article. The last triangle's vertices get a fixed score so that strips aren't
+// favoured over fans, the rest of the cache scores higher the more recently it was used, and vertices with few
+// triangles left score higher so that they get finished off.
+float vertex_score(int cachePosition, uint32_t remainingTriangles)
+{
+    if (remainingTriangles == 0) {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            float scale = 1.0f / (VERTEX_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, 1.5f);
+        }
+    }
+
+    return score + 2.0f / std::sqrt((float)remainingTriangles);
+}
+}
+
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles of each vertex, as ranges into one array. The ranges shrink as triangles get emitted.
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (uint32_t index : indices) {
+        remaining[index]++;
+    }
+
+    std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+    }
+
+    std::vector<uint32_t> vertexTriangles(indices.size());
+    std::vector<uint32_t> filled(vertexCount, 0);
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[t * 3 + k];
+            vertexTriangles[firstTriangle[v] + filled[v]++] = t;
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScores[v] = vertex_score(-1, remaining[v]);
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+
+    // Three extra slots for the vertices pushed in by the newest triangle before the cache is trimmed
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> newCache;
+    cache.reserve(VERTEX_CACHE_SIZE + 3);
+    newCache.reserve(VERTEX_CACHE_SIZE + 3);
+
+    size_t scanPosition = 0;
+    int64_t best = -1;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+        // Nothing in the cache has triangles left, so carry on with the first triangle not emitted yet
+        if (best < 0) {
+            while (emitted[scanPosition]) {
+                scanPosition++;
+            }
+            best = (int64_t)scanPosition;
+        }
+
+        uint32_t t = (uint32_t)best;
+        emitted[t] = true;
+
+        newCache.clear();
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[t * 3 + k];
+            output.push_back(v);
+            newCache.push_back(v);
+
+            uint32_t* begin = &vertexTriangles[firstTriangle[v]];
+            uint32_t* end = begin + remaining[v];
+            *std::find(begin, end, t) = *(end - 1);
+            remaining[v]--;
+        }
+
+        for (uint32_t v : cache) {
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+                newCache.push_back(v);
+            }
+        }
+
+        for (size_t i = 0; i < newCache.size(); ++i) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = i < VERTEX_CACHE_SIZE ? (int)i : -1;
+            vertexScores[v] = vertex_score(cachePosition[v], remaining[v]);
+        }
+
+        newCache.resize(std::min<size_t>(newCache.size(), VERTEX_CACHE_SIZE));
+        std::swap(cache, newCache);
+
+        // Only the triangles around the cached vertices changed score, the best of them goes next
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v : cache) {
+            for (uint32_t i = 0; i < remaining[v]; ++i) {
+                uint32_t other = vertexTriangles[firstTriangle[v] + i];
+                float score = vertexScores[indices[other * 3]] + vertexScores[indices[other * 3 + 1]] + vertexScores[indices[other * 3 + 2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = other;
+                }
+            }
+        }
+    }
+
+    indices = std::move(output);
+}
+
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = (uint32_t)reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    vertices = std::move(reordered);
+}
+
+namespace {
+int16_t to_snorm16(float value)
+{
+    return (int16_t)std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+uint8_t to_unorm8(float value)
+{
+    return (uint8_t)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f);
+}
+
+float sign_not_zero(float value)
+{
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+}
+
+glm::mat4 quantize_vertices(const std::vector<Vertex>& vertices, const AABB& bounds, std::vector<QuantizedVertex>& quantized)
+{
+    glm::vec3 center = bounds.center();
+    glm::vec3 extent = bounds.extent();
+    // Flat meshes have no extent along some axis, any scale works there
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0f) {
+            extent[axis] = 1.0f;
+        }
+    }
+
+    quantized.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const Vertex& vertex = vertices[i];
+        QuantizedVertex& out = quantized[i];
+
+        glm::vec3 pos = (vertex.pos - center) / extent;
+        out.pos[0] = to_snorm16(pos.x);
+        out.pos[1] = to_snorm16(pos.y);
+        out.pos[2] = to_snorm16(pos.z);
+        out.pos[3] = 0;
+
+        glm::vec2 norm = encode_octahedral(vertex.norm);
+        out.norm[0] = to_snorm16(norm.x);
+        out.norm[1] = to_snorm16(norm.y);
+
+        out.color[0] = to_unorm8(vertex.color.r);
+        out.color[1] = to_unorm8(vertex.color.g);
+        out.color[2] = to_unorm8(vertex.color.b);
+        out.color[3] = 255;
+    }
+
+    glm::mat4 dequantize(1.0f);
+    dequantize[0][0] = extent.x;
+    dequantize[1][1] = extent.y;
+    dequantize[2][2] = extent.z;
+    dequantize[3] = glm::vec4(center, 1.0f);
+    return dequantize;
+}
+
+glm::vec2 encode_octahedral(glm::vec3 normal)
+{
+    float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length == 0.0f) {
+        return glm::vec2(0.0f);
+    }
+
+    normal /= length;
+    glm::vec2 encoded(normal.x, normal.y);
+    if (normal.z < 0.0f) {
+        encoded.x = (1.0f - std::abs(normal.y)) * sign_not_zero(normal.x);
+        encoded.y = (1.0f - std::abs(normal.x)) * sign_not_zero(normal.y);
+    }
+
+    return encoded;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Mesh.hpp>
+
+// Turns a triangle list into unique vertices and indices into them. Vertices are merged when they are bitwise equal.
+void deduplicate_vertices(const std::vector<Vertex>& triangles, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Reorders the triangles so that consecutive ones reuse the vertices still in the post-transform cache, using Tom
+// Forsyth's linear-speed vertex cache optimisation. The indices must be a triangle list of indices below vertexCount,
+// which Mesh::set_indexed_vertices checks
+void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+// Reorders the vertices into the order the indices first use them, so vertex fetch walks memory mostly forwards.
+// Vertices no triangle uses are dropped.
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Converts vertices to the quantized layout, with the positions relative to bounds. Returns the transform that takes
+// the positions the vertex shader reads back to local space.
+glm::mat4 quantize_vertices(const std::vector<Vertex>& vertices, const AABB& bounds, std::vector<QuantizedVertex>& quantized);
+
+// Maps a unit vector onto the octahedron and unfolds it into the [-1, 1] square. quantized.vert decodes it
+glm::vec2 encode_octahedral(glm::vec3 normal);
@@ -0,0 +1,118 @@
+#include "Culling.hpp"
+
+#include <algorithm>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Spheres handed to each job
+static constexpr size_t CULL_BATCH = 1024;
+
+// A sphere is visible unless it lies entirely behind one of the planes. Like match_signature the ids are written
+// branchlessly and the count only moves past the ones that passed.
+size_t cull_spheres(const Frustum& frustum, const CullingSpheres& spheres, size_t begin, size_t end, uint32_t* visible)
+{
+    const float* xs = spheres.x.data();
+    const float* ys = spheres.y.data();
+    const float* zs = spheres.z.data();
+    const float* radii = spheres.radius.data();
+    const uint32_t* ids = spheres.ids.data();
+
+    size_t visibleCount = 0;
+    size_t i = begin;
+
+#if defined(__AVX__)
+    __m256 planes[6][4];
+    for (int p = 0; p < 6; ++p) {
+        for (int c = 0; c < 4; ++c) {
+            planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+        }
+    }
+
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(xs + i);
+        __m256 y = _mm256_loadu_ps(ys + i);
+        __m256 z = _mm256_loadu_ps(zs + i);
+        __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radii + i));
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planes[p][0]), _mm256_mul_ps(y, planes[p][1])),
+                _mm256_add_ps(_mm256_mul_ps(z, planes[p][2]), planes[p][3]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+        }
+
+        int bits = _mm256_movemask_ps(inside);
+        for (int lane = 0; lane < 8; ++lane) {
+            visible[visibleCount] = ids[i + lane];
+            visibleCount += (bits >> lane) & 1;
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; ++p) {
+        for (int c = 0; c < 4; ++c) {
+            planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+        }
+    }
+
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radii + i));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planes[p][0]), _mm_mul_ps(y, planes[p][1])),
+                _mm_add_ps(_mm_mul_ps(z, planes[p][2]), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+
+        int bits = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane) {
+            visible[visibleCount] = ids[i + lane];
+            visibleCount += (bits >> lane) & 1;
+        }
+    }
+#endif
+
+    for (; i < end; ++i) {
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.planes) {
+            inside &= plane.x * xs[i] + plane.y * ys[i] + plane.z * zs[i] + plane.w >= -radii[i];
+        }
+
+        visible[visibleCount] = ids[i];
+        visibleCount += inside;
+    }
+
+    return visibleCount;
+}
+
+void cull_spheres(JobSystem& jobs, const Frustum& frustum, const CullingSpheres& spheres, std::vector<uint32_t>& visible)
+{
+    size_t batchCount = (spheres.size() + CULL_BATCH - 1) / CULL_BATCH;
+
+    // Every batch culls into its own part of visible, which are then packed together
+    visible.resize(spheres.size());
+    std::vector<size_t> batchVisible(batchCount);
+
+    jobs.parallel_for(batchCount, 1, [&](size_t first, size_t last, size_t worker) {
+        for (size_t batch = first; batch < last; ++batch) {
+            size_t begin = batch * CULL_BATCH;
+            size_t end = std::min(begin + CULL_BATCH, spheres.size());
+            batchVisible[batch] = cull_spheres(frustum, spheres, begin, end, visible.data() + begin);
+        }
+    });
+
+    size_t visibleCount = 0;
+    for (size_t batch = 0; batch < batchCount; ++batch) {
+        uint32_t* batchBegin = visible.data() + batch * CULL_BATCH;
+        std::copy(batchBegin, batchBegin + batchVisible[batch], visible.data() + visibleCount);
+        visibleCount += batchVisible[batch];
+    }
+
+    visible.resize(visibleCount);
+}
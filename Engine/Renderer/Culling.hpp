@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Bounds.hpp>
+#include <JobSystem.hpp>
+
+// World space bounding spheres laid out as separate arrays so they can be tested several at a time
+struct CullingSpheres {
+    void resize(size_t count)
+    {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        radius.resize(count);
+        ids.resize(count);
+    }
+
+    void set(size_t i, const Sphere& sphere, uint32_t id)
+    {
+        x[i] = sphere.center.x;
+        y[i] = sphere.center.y;
+        z[i] = sphere.center.z;
+        radius[i] = sphere.radius;
+        ids[i] = id;
+    }
+
+    size_t size() const { return ids.size(); }
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+    std::vector<uint32_t> ids;
+};
+
+// Writes the id of every sphere in [begin, end) that is at least partly inside the frustum to visible and returns
+// how many were written. visible needs room for end - begin ids.
+size_t cull_spheres(const Frustum& frustum, const CullingSpheres& spheres, size_t begin, size_t end, uint32_t* visible);
+
+// Same as above over all of the spheres, split across the job system. visible keeps the input order.
+void cull_spheres(JobSystem& jobs, const Frustum& frustum, const CullingSpheres& spheres, std::vector<uint32_t>& visible);
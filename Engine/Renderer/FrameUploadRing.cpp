@@ -0,0 +1,60 @@
+#include "FrameUploadRing.hpp"
+
+#include <stdexcept>
+
+void FrameUploadRing::init(VmaAllocator* allocator, VkDeviceSize frameSize, int frameCount, VkBufferUsageFlags usage)
+{
+    m_frameSize = frameSize;
+
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = frameSize * frameCount;
+    bufferInfo.usage = usage;
+
+    VmaAllocationCreateInfo vmaAllocInfo {};
+    vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocationInfo;
+    if (vmaCreateBuffer(*allocator, &bufferInfo, &vmaAllocInfo, &m_buffer.buffer, &m_buffer.allocation, &allocationInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate upload ring");
+    }
+
+    m_buffer.allocator = allocator;
+    m_buffer.inUse = true;
+    m_mapped = (char*)allocationInfo.pMappedData;
+}
+
+void FrameUploadRing::cleanup()
+{
+    if (m_buffer.inUse) {
+        vmaDestroyBuffer(*m_buffer.allocator, m_buffer.buffer, m_buffer.allocation);
+        m_buffer.inUse = false;
+        m_mapped = nullptr;
+    }
+}
+
+void FrameUploadRing::begin_frame(int frameIndex)
+{
+    m_frameBegin = frameIndex * m_frameSize;
+    m_head = m_frameBegin;
+}
+
+UploadAllocation FrameUploadRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    // Alignments from the device limits are always powers of two
+    VkDeviceSize offset = (m_head + alignment - 1) & ~(alignment - 1);
+    if (offset + size > m_frameBegin + m_frameSize) {
+        throw std::runtime_error("Frame upload ring is out of space");
+    }
+
+    m_head = offset + size;
+    return { m_mapped + offset, offset };
+}
+
+void FrameUploadRing::flush()
+{
+    if (m_head > m_frameBegin) {
+        vmaFlushAllocation(*m_buffer.allocator, m_buffer.allocation, m_frameBegin, m_head - m_frameBegin);
+    }
+}
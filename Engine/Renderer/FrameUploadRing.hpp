@@ -0,0 +1,38 @@
+#pragma once
+
+#include <ThirdParty/vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <Renderer/VulkanTypes.hpp>
+
+struct UploadAllocation {
+    void* data;
+    // Offset into FrameUploadRing::get_buffer(), usable as a dynamic descriptor offset
+    VkDeviceSize offset;
+};
+
+// One persistently mapped buffer split into a region per frame in flight. Data that changes every frame is bump
+// allocated out of the current frame's region, which is only reused once that frame's fence has signaled, so nothing
+// is ever mapped, unmapped or waited on per allocation.
+class FrameUploadRing {
+public:
+    void init(VmaAllocator* allocator, VkDeviceSize frameSize, int frameCount, VkBufferUsageFlags usage);
+    void cleanup();
+
+    // Starts allocating from the region of frameIndex. Everything allocated there before must no longer be in use
+    void begin_frame(int frameIndex);
+    UploadAllocation allocate(VkDeviceSize size, VkDeviceSize alignment);
+    // Makes this frame's writes visible to the device, needed when the memory isn't host coherent
+    void flush();
+
+    VkBuffer get_buffer() { return m_buffer.buffer; }
+    VkDeviceSize get_frame_size() { return m_frameSize; }
+
+private:
+    AllocatedBuffer m_buffer;
+    char* m_mapped = nullptr;
+
+    VkDeviceSize m_frameSize = 0;
+    VkDeviceSize m_frameBegin = 0;
+    VkDeviceSize m_head = 0;
+};
@@ -0,0 +1,107 @@
+#include "GeometryArena.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+void GeometryArena::init(VmaAllocator* allocator, uint32_t stride, uint32_t blockCapacity, VkBufferUsageFlags usage)
+{
+    m_allocator = allocator;
+    m_stride = stride;
+    m_blockCapacity = blockCapacity;
+    m_usage = usage;
+}
+
+void GeometryArena::cleanup()
+{
+    for (Block& block : m_blocks) {
+        vmaDestroyBuffer(*m_allocator, block.buffer.buffer, block.buffer.allocation);
+    }
+    m_blocks.clear();
+    m_freeBySize.clear();
+}
+
+GeometryAllocation GeometryArena::allocate(uint32_t count)
+{
+    if (count == 0) {
+        return {};
+    }
+
+    // The smallest free range that fits
+    auto fit = m_freeBySize.lower_bound({ count, 0, 0 });
+    if (fit == m_freeBySize.end()) {
+        // Geometry bigger than a block gets a block of its own size
+        add_block(std::max(count, m_blockCapacity));
+        fit = m_freeBySize.find({ m_blocks.back().capacity, (uint32_t)m_blocks.size() - 1, 0 });
+    }
+
+    auto [freeCount, block, offset] = *fit;
+    erase_free_range(block, m_blocks[block].freeRanges.find(offset));
+    if (freeCount > count) {
+        insert_free_range(block, offset + count, freeCount - count);
+    }
+
+    return { block, offset, count };
+}
+
+void GeometryArena::free(const GeometryAllocation& allocation)
+{
+    if (!allocation.valid()) {
+        return;
+    }
+
+    std::map<uint32_t, uint32_t>& freeRanges = m_blocks[allocation.block].freeRanges;
+    uint32_t offset = allocation.offset;
+    uint32_t count = allocation.count;
+
+    auto next = freeRanges.lower_bound(offset);
+    if (next != freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            count += previous->second;
+            erase_free_range(allocation.block, previous);
+        }
+    }
+    if (next != freeRanges.end() && offset + count == next->first) {
+        count += next->second;
+        erase_free_range(allocation.block, next);
+    }
+
+    insert_free_range(allocation.block, offset, count);
+}
+
+void GeometryArena::insert_free_range(uint32_t block, uint32_t offset, uint32_t count)
+{
+    m_blocks[block].freeRanges.emplace(offset, count);
+    m_freeBySize.emplace(count, block, offset);
+}
+
+void GeometryArena::erase_free_range(uint32_t block, std::map<uint32_t, uint32_t>::iterator range)
+{
+    m_freeBySize.erase({ range->second, block, range->first });
+    m_blocks[block].freeRanges.erase(range);
+}
+
+void GeometryArena::add_block(uint32_t capacity)
+{
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = (VkDeviceSize)capacity * m_stride;
+    bufferInfo.usage = m_usage;
+
+    VmaAllocationCreateInfo vmaAllocInfo {};
+    vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    Block block;
+    if (vmaCreateBuffer(*m_allocator, &bufferInfo, &vmaAllocInfo, &block.buffer.buffer, &block.buffer.allocation, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate geometry arena block");
+    }
+
+    block.buffer.allocator = m_allocator;
+    block.buffer.inUse = true;
+    block.capacity = capacity;
+
+    m_blocks.push_back(std::move(block));
+    insert_free_range((uint32_t)m_blocks.size() - 1, 0, capacity);
+}
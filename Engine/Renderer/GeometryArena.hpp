@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include <ThirdParty/vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+#include <Renderer/VulkanTypes.hpp>
+
+struct GeometryAllocation {
+    bool valid() const { return block != UINT32_MAX; }
+
+    uint32_t block = UINT32_MAX;
+    // In elements of the arena's stride, so it can be passed as firstVertex or vertexOffset as is
+    uint32_t offset = 0;
+    uint32_t count = 0;
+};
+
+// A few large device-local buffers that the geometry of every mesh is sub-allocated from, so that draws of different meshes share
+// one buffer binding and can be merged into multi-draws. Each block keeps its free ranges sorted by offset, so a freed
+// range can be merged with its free neighbours, and all of them are indexed by size, so the best fit is found in
+// logarithmic time. A new block is only added when no existing one has room.
+class GeometryArena {
+public:
+    void init(VmaAllocator* allocator, uint32_t stride, uint32_t blockCapacity, VkBufferUsageFlags usage);
+    void cleanup();
+
+    // count elements in one block, throws if no block can be created for them
+    GeometryAllocation allocate(uint32_t count);
+    // The range must not be in use by any frame in flight anymore
+    void free(const GeometryAllocation& allocation);
+
+    // Byte offset of the allocation in its block's buffer, for uploading into it
+    VkDeviceSize get_byte_offset(const GeometryAllocation& allocation) const { return (VkDeviceSize)allocation.offset * m_stride; }
+    VkDeviceSize get_byte_size(const GeometryAllocation& allocation) const { return (VkDeviceSize)allocation.count * m_stride; }
+
+    VkBuffer get_buffer(uint32_t block) const { return m_blocks[block].buffer.buffer; }
+    uint32_t get_block_count() const { return (uint32_t)m_blocks.size(); }
+    uint32_t get_stride() const { return m_stride; }
+
+private:
+    struct Block {
+        AllocatedBuffer buffer;
+        uint32_t capacity;
+        // Offset to count
+        std::map<uint32_t, uint32_t> freeRanges;
+    };
+
+    void add_block(uint32_t capacity);
+    // Keep a block's freeRanges and m_freeBySize in sync
+    void insert_free_range(uint32_t block, uint32_t offset, uint32_t count);
+    void erase_free_range(uint32_t block, std::map<uint32_t, uint32_t>::iterator range);
+
+    VmaAllocator* m_allocator = nullptr;
+    uint32_t m_stride = 0;
+    uint32_t m_blockCapacity = 0;
+    VkBufferUsageFlags m_usage = 0;
+
+    std::vector<Block> m_blocks;
+    // Every free range of every block as count, block, offset. Ties go to the lowest block and offset
+    std::set<std::tuple<uint32_t, uint32_t, uint32_t>> m_freeBySize;
+};
@@ -16,29 +16,40 @@ void PresentPass::init(std::shared_ptr<GlobalRenderContext> globalData)
     create_render_pass();
     create_framebuffers(false);
     create_pipelines();
+    create_cull_pipeline();
     create_sync_objects();
+    create_worker_commands();
 }
 
 void PresentPass::update()
 {
     vkWaitForFences(m_globalData->device, 1, &m_passData.inFlightFences[m_globalData->frameIndex], VK_TRUE, UINT64_MAX);
+    m_globalData->uploadRing.begin_frame(m_globalData->frameIndex);
 
-    VkResult result = vkAcquireNextImageKHR(m_globalData->device,
-        m_swapchain,
-        UINT64_MAX,
-        m_passData.availableSemaphores[m_globalData->frameIndex],
-        VK_NULL_HANDLE,
-        &m_globalData->swapchainIndex);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        result = vkAcquireNextImageKHR(m_globalData->device,
+    // Meshes set since the last frame are copied while this frame is recorded, and drawn once the copies are done
+    m_globalData->uploads.submit();
+
+    if (m_globalData->headless) {
+        // Offscreen images are used in order, one per frame in flight
+        m_globalData->swapchainIndex = m_globalData->frameIndex;
+    } else {
+        VkResult result = vkAcquireNextImageKHR(m_globalData->device,
             m_swapchain,
             UINT64_MAX,
             m_passData.availableSemaphores[m_globalData->frameIndex],
             VK_NULL_HANDLE,
             &m_globalData->swapchainIndex);
-    }
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to acquire next swapchain image");
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            result = vkAcquireNextImageKHR(m_globalData->device,
+                m_swapchain,
+                UINT64_MAX,
+                m_passData.availableSemaphores[m_globalData->frameIndex],
+                VK_NULL_HANDLE,
+                &m_globalData->swapchainIndex);
+        }
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to acquire next swapchain image");
+        }
     }
 
     if (m_passData.imageInFlight[m_globalData->swapchainIndex] != VK_NULL_HANDLE) {
@@ -54,7 +65,7 @@ void PresentPass::update()
     rpInfo.renderPass = m_passData.renderPass;
     rpInfo.framebuffer = m_passData.framebuffers[m_globalData->swapchainIndex];
     rpInfo.renderArea.offset = { 0, 0 };
-    rpInfo.renderArea.extent = m_swapchain.extent;
+    rpInfo.renderArea.extent = m_extent;
     VkClearValue clearColor { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
     VkClearValue clearDepth {};
     clearDepth.depthStencil.depth = 1.0f;
@@ -63,18 +74,6 @@ void PresentPass::update()
     rpInfo.clearValueCount = 2;
     rpInfo.pClearValues = clearValues;
 
-    VkViewport viewport {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)m_swapchain.extent.width;
-    viewport.height = (float)m_swapchain.extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor {};
-    scissor.offset = { 0, 0 };
-    scissor.extent = m_swapchain.extent;
-
     VkCommandBufferBeginInfo beginInfo {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -82,23 +81,39 @@ void PresentPass::update()
         throw std::runtime_error("Failed to begin command buffer");
     }
 
-    vkCmdSetViewport(m_globalData->commandBuffers[m_globalData->swapchainIndex], 0, 1, &viewport);
-    vkCmdSetScissor(m_globalData->commandBuffers[m_globalData->swapchainIndex], 0, 1, &scissor);
+    m_globalData->uploads.record_acquires(m_globalData->commandBuffers[m_globalData->swapchainIndex]);
+    prepare_frame(m_globalData->commandBuffers[m_globalData->swapchainIndex]);
 
-    vkCmdBeginRenderPass(m_globalData->commandBuffers[m_globalData->swapchainIndex], &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(m_globalData->commandBuffers[m_globalData->swapchainIndex], &rpInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
     record_commands(m_globalData->commandBuffers[m_globalData->swapchainIndex]);
 
     vkCmdEndRenderPass(m_globalData->commandBuffers[m_globalData->swapchainIndex]);
 
+    if (m_globalData->headless && m_globalData->readback) {
+        record_readback(m_globalData->commandBuffers[m_globalData->swapchainIndex]);
+    }
+
     vkEndCommandBuffer(m_globalData->commandBuffers[m_globalData->swapchainIndex]);
 
-    VkSemaphore waitSemaphores[] = { m_passData.availableSemaphores[m_globalData->frameIndex] };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    m_globalData->uploadRing.flush();
+
+    // Waiting on a value the upload timeline already reached costs nothing. The value of the binary semaphore is
+    // ignored.
+    VkSemaphore waitSemaphores[] = { m_globalData->uploads.get_semaphore(), m_passData.availableSemaphores[m_globalData->frameIndex] };
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    uint64_t waitValues[] = { m_globalData->uploads.get_submitted_value(), 0 };
+    uint32_t waitCount = m_globalData->headless ? 1 : 2;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = waitCount;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = waitCount;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
@@ -106,12 +121,17 @@ void PresentPass::update()
     submitInfo.pCommandBuffers = &m_globalData->commandBuffers[m_globalData->swapchainIndex];
 
     VkSemaphore signalSemaphores[] = { m_passData.finishedSemaphores[m_globalData->frameIndex] };
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = m_globalData->headless ? 0 : 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
     if (vkQueueSubmit(m_globalData->graphicsQueue, 1, &submitInfo, m_passData.inFlightFences[m_globalData->frameIndex]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to submit queue");
     }
 
+    m_lastSubmittedFrame = m_globalData->frameIndex;
+    if (m_globalData->headless) {
+        return;
+    }
+
     VkSwapchainKHR swapchain = m_swapchain;
 
     VkPresentInfoKHR presentInfo {};
@@ -133,6 +153,7 @@ void PresentPass::exit()
     m_em.each_component<Mesh>([this](ECS::Entity& e, Mesh* m) {
         m->cleanup();
     });
+    m_globalData->destroy_pending(true);
 
     for (auto& f : m_cleanupQueue) {
         f();
@@ -141,33 +162,43 @@ void PresentPass::exit()
 
 void PresentPass::create_swapchain(bool recreation = false)
 {
-    if (recreation) {
-        m_swapchain.destroy_image_views(m_passData.imageViews);
-    }
-    vkb::SwapchainBuilder swapchainBuilder(m_globalData->device);
-    auto swapRet = swapchainBuilder.set_old_swapchain(m_swapchain).build();
-    if (!swapRet) {
-        throw std::runtime_error("Failed to create swapchain");
-    }
+    // The recorded secondary buffers bake in the viewport and scissor
+    invalidate_recorded_commands();
 
-    vkb::destroy_swapchain(m_swapchain);
-    m_swapchain = swapRet.value();
+    if (m_globalData->headless) {
+        create_offscreen_targets();
+    } else {
+        if (recreation) {
+            m_swapchain.destroy_image_views(m_passData.imageViews);
+        }
+        vkb::SwapchainBuilder swapchainBuilder(m_globalData->device);
+        auto swapRet = swapchainBuilder.set_old_swapchain(m_swapchain).build();
+        if (!swapRet) {
+            throw std::runtime_error("Failed to create swapchain");
+        }
 
-    m_passData.images = m_swapchain.get_images().value();
-    m_passData.imageViews = m_swapchain.get_image_views().value();
-    m_globalData->numSwapchainImages = m_passData.images.size();
+        vkb::destroy_swapchain(m_swapchain);
+        m_swapchain = swapRet.value();
 
-    if (!recreation) {
-        m_cleanupQueue.push_front([this]() {
-            m_swapchain.destroy_image_views(m_passData.imageViews);
-            vkb::destroy_swapchain(m_swapchain);
-        });
+        m_passData.images = m_swapchain.get_images().value();
+        m_passData.imageViews = m_swapchain.get_image_views().value();
+        m_globalData->numSwapchainImages = m_passData.images.size();
+
+        if (!recreation) {
+            m_cleanupQueue.push_front([this]() {
+                m_swapchain.destroy_image_views(m_passData.imageViews);
+                vkb::destroy_swapchain(m_swapchain);
+            });
+        }
+
+        m_extent = m_swapchain.extent;
+        m_colorFormat = m_swapchain.image_format;
     }
 
     m_passData.depthImages.resize(m_passData.images.size());
     m_passData.depthImageViews.resize(m_passData.imageViews.size());
 
-    VkExtent3D depthImageExtent = { m_swapchain.extent.width, m_swapchain.extent.height, 1 };
+    VkExtent3D depthImageExtent = { m_extent.width, m_extent.height, 1 };
 
     VkImageCreateInfo depthCreateInfo = image_create_info(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
 
@@ -208,17 +239,67 @@ void PresentPass::create_swapchain(bool recreation = false)
     }
 }
 
+void PresentPass::create_offscreen_targets()
+{
+    m_extent = m_globalData->windowSize;
+    m_colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+    m_offscreenImages.resize(MAX_FRAMES_IN_FLIGHT);
+    m_passData.images.resize(MAX_FRAMES_IN_FLIGHT);
+    m_passData.imageViews.resize(MAX_FRAMES_IN_FLIGHT);
+    m_globalData->numSwapchainImages = MAX_FRAMES_IN_FLIGHT;
+
+    VkImageCreateInfo imageInfo = image_create_info(m_colorFormat,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        { m_extent.width, m_extent.height, 1 });
+
+    VmaAllocationCreateInfo allocInfo {};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (vmaCreateImage(m_globalData->allocator, &imageInfo, &allocInfo, &m_offscreenImages[i].image, &m_offscreenImages[i].allocation, nullptr) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate offscreen image");
+        }
+        m_offscreenImages[i].inUse = true;
+        m_offscreenImages[i].allocator = std::make_shared<VmaAllocator>(m_globalData->allocator);
+        m_passData.images[i] = m_offscreenImages[i].image;
+
+        VkImageViewCreateInfo viewInfo = image_view_create_info(m_colorFormat, m_passData.images[i], VK_IMAGE_ASPECT_COLOR_BIT);
+        if (vkCreateImageView(m_globalData->device, &viewInfo, nullptr, &m_passData.imageViews[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create offscreen image view");
+        }
+
+        m_cleanupQueue.push_front([this, i]() {
+            vkDestroyImageView(m_globalData->device, m_passData.imageViews[i], nullptr);
+            vmaDestroyImage(m_globalData->allocator, m_offscreenImages[i].image, m_offscreenImages[i].allocation);
+        });
+    }
+
+    if (m_globalData->readback) {
+        m_readbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            m_readbackBuffers[i] = create_buffer(&m_globalData->allocator,
+                (size_t)m_extent.width * m_extent.height * 4, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+            m_cleanupQueue.push_front([this, i]() {
+                vmaDestroyBuffer(m_globalData->allocator, m_readbackBuffers[i].buffer, m_readbackBuffers[i].allocation);
+            });
+        }
+    }
+}
+
 void PresentPass::create_render_pass()
 {
     VkAttachmentDescription colorAttachment {};
-    colorAttachment.format = m_swapchain.image_format;
+    colorAttachment.format = m_colorFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Offscreen images are only ever read back
+    colorAttachment.finalLayout = m_globalData->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
@@ -261,8 +342,17 @@ void PresentPass::create_render_pass()
     depthDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
     depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+    // Makes the color writes visible to the readback copy that follows the pass in headless mode
+    VkSubpassDependency readbackDependency {};
+    readbackDependency.srcSubpass = 0;
+    readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
     VkAttachmentDescription attachments[2] = { colorAttachment, depthAttachment };
-    VkSubpassDependency dependencies[2] = { dependency, depthDependency };
+    VkSubpassDependency dependencies[3] = { dependency, depthDependency, readbackDependency };
 
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -270,7 +360,7 @@ void PresentPass::create_render_pass()
     renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.dependencyCount = m_globalData->headless ? 3 : 2;
     renderPassInfo.pDependencies = dependencies;
 
     if (vkCreateRenderPass(m_globalData->device, &renderPassInfo, nullptr, &m_passData.renderPass) != VK_SUCCESS) {
@@ -293,8 +383,8 @@ void PresentPass::create_framebuffers(bool recreation = false)
         framebufferInfo.renderPass = m_passData.renderPass;
         framebufferInfo.attachmentCount = 2;
         framebufferInfo.pAttachments = attachments;
-        framebufferInfo.width = m_swapchain.extent.width;
-        framebufferInfo.height = m_swapchain.extent.height;
+        framebufferInfo.width = m_extent.width;
+        framebufferInfo.height = m_extent.height;
         framebufferInfo.layers = 1;
 
         if (vkCreateFramebuffer(m_globalData->device, &framebufferInfo, nullptr, &m_passData.framebuffers[i]) != VK_SUCCESS) {
@@ -309,43 +399,44 @@ void PresentPass::create_framebuffers(bool recreation = false)
     }
 }
 
-void PresentPass::create_pipelines()
+VkShaderModule PresentPass::load_shader_module(const std::string& filename)
 {
-    auto createShaderModule = [this](std::string filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open file");
-        }
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open file");
+    }
 
-        size_t fileSize = (size_t)file.tellg();
-        std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+    size_t fileSize = (size_t)file.tellg();
+    std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
 
-        file.seekg(0);
-        file.read((char*)buffer.data(), fileSize * sizeof(uint32_t));
+    file.seekg(0);
+    file.read((char*)buffer.data(), buffer.size() * sizeof(uint32_t));
 
-        file.close();
+    file.close();
 
-        VkShaderModuleCreateInfo createInfo {};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = buffer.size() * sizeof(uint32_t);
-        createInfo.pCode = buffer.data();
+    VkShaderModuleCreateInfo createInfo {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = buffer.size() * sizeof(uint32_t);
+    createInfo.pCode = buffer.data();
 
-        VkShaderModule shaderModule;
-        if (vkCreateShaderModule(m_globalData->device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create shader module");
-        }
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(m_globalData->device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create shader module");
+    }
 
-        return shaderModule;
-    };
+    return shaderModule;
+}
 
-    VkShaderModule vertModule = createShaderModule("meshvert.spv");
-    VkShaderModule fragModule = createShaderModule("meshfrag.spv");
+void PresentPass::create_pipelines()
+{
+    // Indexed by VertexLayout, the quantized vertex shader unpacks the normal and takes the color as normalized bytes
+    const char* vertShaders[VERTEX_LAYOUT_COUNT] = { "meshvert.spv", "quantizedvert.spv" };
+    VkShaderModule fragModule = load_shader_module("meshfrag.spv");
 
     VkPipelineShaderStageCreateInfo vertStageInfo {};
     vertStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vertStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertStageInfo.module = vertModule;
     vertStageInfo.pName = "main";
 
     VkPipelineShaderStageCreateInfo fragStageInfo {};
@@ -356,14 +447,8 @@ void PresentPass::create_pipelines()
 
     VkPipelineShaderStageCreateInfo shaderStages[] = { vertStageInfo, fragStageInfo };
 
-    VertexInputDescription vertexDescription = Vertex::get_vertex_description();
-
     VkPipelineVertexInputStateCreateInfo vertexInputInfo {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
-    vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
-    vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
-    vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
 
     VkPipelineInputAssemblyStateCreateInfo inputAssembly {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -373,14 +458,14 @@ void PresentPass::create_pipelines()
     VkViewport viewport {};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
-    viewport.width = (float)m_swapchain.extent.width;
-    viewport.height = (float)m_swapchain.extent.height;
+    viewport.width = (float)m_extent.width;
+    viewport.height = (float)m_extent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
 
     VkRect2D scissor = {};
     scissor.offset = { 0, 0 };
-    scissor.extent = m_swapchain.extent;
+    scissor.extent = m_extent;
 
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -464,17 +549,180 @@ void PresentPass::create_pipelines()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(m_globalData->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_passData.pipeline) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create graphics pipeline");
-    }
-
+    m_passData.pipelines.assign(VERTEX_LAYOUT_COUNT, VK_NULL_HANDLE);
     m_cleanupQueue.push_front([this]() {
         vkDestroyPipelineLayout(m_globalData->device, m_passData.pipelineLayout, nullptr);
-        vkDestroyPipeline(m_globalData->device, m_passData.pipeline, nullptr);
+        for (VkPipeline pipeline : m_passData.pipelines) {
+            vkDestroyPipeline(m_globalData->device, pipeline, nullptr);
+        }
     });
 
+    for (size_t layout = 0; layout < VERTEX_LAYOUT_COUNT; ++layout) {
+        VkShaderModule vertModule = load_shader_module(vertShaders[layout]);
+        shaderStages[0].module = vertModule;
+
+        VertexInputDescription vertexDescription = get_vertex_description((VertexLayout)layout);
+        vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
+        vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
+        vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
+        vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
+
+        VkResult result = vkCreateGraphicsPipelines(m_globalData->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_passData.pipelines[layout]);
+        vkDestroyShaderModule(m_globalData->device, vertModule, nullptr);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create graphics pipeline");
+        }
+    }
+
     vkDestroyShaderModule(m_globalData->device, fragModule, nullptr);
-    vkDestroyShaderModule(m_globalData->device, vertModule, nullptr);
+}
+
+void PresentPass::create_cull_pipeline()
+{
+    VkDescriptorSetLayoutBinding bindings[3] {};
+    for (uint32_t i = 0; i < 3; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo setInfo {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setInfo.bindingCount = 3;
+    setInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(m_globalData->device, &setInfo, nullptr, &m_cullSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create cull descriptor set layout");
+    }
+
+    VkDescriptorSetLayout setLayouts[2] = { m_cullSetLayout, m_cullSetLayout };
+
+    VkDescriptorSetAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_globalData->descriptorPool;
+    allocInfo.descriptorSetCount = 2;
+    allocInfo.pSetLayouts = setLayouts;
+
+    VkDescriptorSet sets[2];
+    if (vkAllocateDescriptorSets(m_globalData->device, &allocInfo, sets) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate cull descriptor set");
+    }
+    m_cullDescriptor = sets[0];
+    m_compactDescriptor = sets[1];
+
+    // Everything is in the upload ring. cull.comp reads the instances, counts up the draw commands and writes the
+    // scene buffer. compact.comp reads the draw commands and writes the compacted ones and the per block counts.
+    VkDeviceSize ranges[2][3] = {
+        { ECS::MAX_ENTITIES * sizeof(GPUInstance), ECS::MAX_ENTITIES * sizeof(VkDrawIndexedIndirectCommand), ECS::MAX_ENTITIES * sizeof(glm::mat4) },
+        { ECS::MAX_ENTITIES * sizeof(VkDrawIndexedIndirectCommand), ECS::MAX_ENTITIES * sizeof(VkDrawIndexedIndirectCommand), ECS::MAX_ENTITIES * sizeof(uint32_t) }
+    };
+
+    VkDescriptorBufferInfo bufferInfos[2][3] {};
+    VkWriteDescriptorSet writes[6] {};
+    for (uint32_t s = 0; s < 2; s++) {
+        for (uint32_t i = 0; i < 3; i++) {
+            bufferInfos[s][i].buffer = m_globalData->uploadRing.get_buffer();
+            bufferInfos[s][i].offset = 0;
+            bufferInfos[s][i].range = ranges[s][i];
+
+            VkWriteDescriptorSet& write = writes[s * 3 + i];
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = sets[s];
+            write.dstBinding = i;
+            write.descriptorCount = 1;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+            write.pBufferInfo = &bufferInfos[s][i];
+        }
+    }
+
+    vkUpdateDescriptorSets(m_globalData->device, 6, writes, 0, nullptr);
+
+    VkPushConstantRange pushConstant {};
+    pushConstant.offset = 0;
+    pushConstant.size = sizeof(CullPushConstants);
+    pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_cullSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+    if (vkCreatePipelineLayout(m_globalData->device, &pipelineLayoutInfo, nullptr, &m_cullPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create cull pipeline layout");
+    }
+
+    VkShaderModule cullModule = load_shader_module("cullcomp.spv");
+    VkShaderModule compactModule = load_shader_module("compactcomp.spv");
+
+    VkComputePipelineCreateInfo pipelineInfos[2] {};
+    VkShaderModule modules[2] = { cullModule, compactModule };
+    for (int i = 0; i < 2; i++) {
+        pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfos[i].stage.module = modules[i];
+        pipelineInfos[i].stage.pName = "main";
+        pipelineInfos[i].layout = m_cullPipelineLayout;
+    }
+
+    VkPipeline pipelines[2];
+    if (vkCreateComputePipelines(m_globalData->device, VK_NULL_HANDLE, 2, pipelineInfos, nullptr, pipelines) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create cull pipeline");
+    }
+    m_cullPipeline = pipelines[0];
+    m_compactPipeline = pipelines[1];
+
+    m_cleanupQueue.push_front([this]() {
+        vkDestroyPipeline(m_globalData->device, m_compactPipeline, nullptr);
+        vkDestroyPipeline(m_globalData->device, m_cullPipeline, nullptr);
+        vkDestroyPipelineLayout(m_globalData->device, m_cullPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(m_globalData->device, m_cullSetLayout, nullptr);
+    });
+
+    vkDestroyShaderModule(m_globalData->device, compactModule, nullptr);
+    vkDestroyShaderModule(m_globalData->device, cullModule, nullptr);
+}
+
+void PresentPass::create_worker_commands()
+{
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_globalData->device.get_queue_index(vkb::QueueType::graphics).value();
+
+    m_workerCommands.resize(MAX_FRAMES_IN_FLIGHT);
+    m_secondaryBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    m_recorded.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        m_workerCommands[frame].resize(m_jobs.worker_count());
+
+        for (WorkerCommands& worker : m_workerCommands[frame]) {
+            if (vkCreateCommandPool(m_globalData->device, &poolInfo, nullptr, &worker.pool) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create worker command pool");
+            }
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = worker.pool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            if (vkAllocateCommandBuffers(m_globalData->device, &allocInfo, &worker.buffer) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to allocate worker command buffer");
+            }
+        }
+    }
+
+    m_cleanupQueue.push_front([this]() {
+        for (std::vector<WorkerCommands>& frame : m_workerCommands) {
+            for (WorkerCommands& worker : frame) {
+                vkDestroyCommandPool(m_globalData->device, worker.pool, nullptr);
+            }
+        }
+    });
 }
 
 void PresentPass::create_sync_objects()
@@ -482,7 +730,7 @@ void PresentPass::create_sync_objects()
     m_passData.availableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     m_passData.finishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     m_passData.inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-    m_passData.imageInFlight.resize(m_swapchain.image_count, VK_NULL_HANDLE);
+    m_passData.imageInFlight.resize(m_passData.images.size(), VK_NULL_HANDLE);
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -506,58 +754,413 @@ void PresentPass::create_sync_objects()
     }
 }
 
-void PresentPass::record_commands(VkCommandBuffer cmd)
+void PresentPass::gather_instances()
+{
+    m_em.query<Mesh>(m_meshEntities);
+    m_cullingSpheres.resize(m_meshEntities.size());
+
+    // Looked up here rather than on the workers, which only index into the component arrays
+    ECS::ComponentView<Transform> transforms = m_em.view<Transform>();
+    ECS::ComponentView<PreviousTransform> previousTransforms = m_em.view<PreviousTransform>();
+    ECS::ComponentView<Mesh> meshes = m_em.view<Mesh>();
+
+    // Gathering transforms only reads components, so it is split across the workers
+    m_jobs.parallel_for(m_meshEntities.size(), 256, [&](size_t begin, size_t end, size_t worker) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t eid = m_meshEntities[i];
+
+            glm::mat4 model(1.0f);
+            if (Transform* t = transforms.get(eid)) {
+                if (PreviousTransform* previous = previousTransforms.get(eid)) {
+                    model = interpolate(previous->transform, *t, m_globalData->interpolationAlpha).getTransform();
+                } else {
+                    model = t->getTransform();
+                }
+            }
+
+            Mesh* mesh = meshes.get(eid);
+            const MeshData* data = mesh->get_data();
+            m_meshData[eid] = data;
+
+            const Sphere& local = mesh->get_bounding_sphere();
+            float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            Sphere world = { glm::vec3(model * glm::vec4(local.center, 1.0f)), local.radius * scale };
+
+            // Quantized positions are relative to the mesh bounds, folding the way back into the model matrix keeps
+            // the vertex shaders of both layouts the same apart from their inputs
+            m_modelMatrices[eid] = data->layout == VertexLayout::Float ? model : model * data->dequantize;
+
+            m_worldSpheres[eid] = glm::vec4(world.center, world.radius);
+            m_cullingSpheres.set(i, world, eid);
+        }
+    });
+}
+
+void PresentPass::cull_entities()
+{
+    cull_spheres(m_jobs, m_frustum, m_cullingSpheres, m_visibleEntities);
+}
+
+void PresentPass::build_batches(const std::vector<uint32_t>& eids)
 {
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_passData.pipeline);
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_passData.pipelineLayout,
-        0, 1, &m_globalData->globalDescriptor[m_globalData->frameIndex], 0, nullptr);
+    m_instances.clear();
+    for (uint32_t eid : eids) {
+        const MeshData* mesh = m_meshData[eid];
+        if (mesh->indexRange.valid()) {
+            m_instances.emplace_back(mesh, eid);
+        }
+    }
 
-    m_em.each_component<Mesh>([this, cmd](ECS::Entity& e, Mesh* m) {
-        record_entity_commands(cmd, e);
+    // Brings the instances of each mesh together, and the meshes sharing a vertex layout and arena blocks
+    std::sort(m_instances.begin(), m_instances.end(), [](const auto& a, const auto& b) {
+        return std::make_tuple(a.first->layout, a.first->vertexRange.block, a.first->indexRange.block, a.first, a.second)
+            < std::make_tuple(b.first->layout, b.first->vertexRange.block, b.first->indexRange.block, b.first, b.second);
     });
+
+    m_batches.clear();
+    m_blockDraws.clear();
+    for (uint32_t i = 0; i < m_instances.size(); ++i) {
+        const MeshData* mesh = m_instances[i].first;
+        if (m_batches.empty() || m_batches.back().mesh != mesh) {
+            if (m_blockDraws.empty() || m_blockDraws.back().layout != mesh->layout
+                || m_blockDraws.back().vertexBlock != mesh->vertexRange.block
+                || m_blockDraws.back().indexBlock != mesh->indexRange.block) {
+                m_blockDraws.push_back({ mesh->layout, mesh->vertexRange.block, mesh->indexRange.block, (uint32_t)m_batches.size(), 0 });
+            }
+            m_blockDraws.back().batchCount++;
+
+            m_batches.push_back({ mesh, mesh->id, i, 0 });
+        }
+        m_batches.back().instanceCount++;
+    }
 }
 
-void PresentPass::record_entity_commands(VkCommandBuffer cmd, ECS::Entity& e)
+void PresentPass::prepare_frame(VkCommandBuffer cmd)
 {
-    if (!e.get_component<Mesh>().has_value()) {
-        throw std::runtime_error("Attempted to render entity with no renderable components");
+    FrameUploadRing& ring = m_globalData->uploadRing;
+
+    GPUCameraData camData;
+    camData.view = m_globalData->camera.second.getTransform();
+    camData.proj = m_globalData->camera.first.getProjMatrix(m_globalData->windowSize.width, m_globalData->windowSize.height);
+    m_frustum = Frustum::from_matrix(camData.proj * camData.view);
+
+    UploadAllocation camera = ring.allocate(sizeof(GPUCameraData), m_globalData->uniformAlignment);
+    memcpy(camera.data, &camData, sizeof(GPUCameraData));
+
+    // Matrices of the visible instances packed in draw order. The binding covers MAX_ENTITIES of them, which is as
+    // many as there can be.
+    UploadAllocation models = ring.allocate(ECS::MAX_ENTITIES * sizeof(glm::mat4), m_globalData->storageAlignment);
+    m_frameModels = (glm::mat4*)models.data;
+
+    m_offsets.scene[0] = (uint32_t)camera.offset;
+    m_offsets.scene[1] = (uint32_t)models.offset;
+
+    gather_instances();
+
+    if (m_globalData->gpuCulling) {
+        build_batches(m_meshEntities);
+        record_gpu_culling(cmd);
+    } else {
+        cull_entities();
+        build_batches(m_visibleEntities);
+        for (size_t i = 0; i < m_instances.size(); ++i) {
+            m_frameModels[i] = m_modelMatrices[m_instances[i].second];
+        }
     }
 
-    Mesh* mesh = e.get_component<Mesh>().value();
+    // The ring hands out the same offsets every time a frame in flight comes around again, as long as the same
+    // allocations are made, so compare against what this frame's buffers were recorded with
+    RecordedCommands& recorded = m_recorded[m_globalData->frameIndex];
+    if (m_batches != recorded.batches || m_globalData->gpuCulling != recorded.gpuCulling || !(m_offsets == recorded.offsets)) {
+        recorded.generation = 0;
+        recorded.batches = m_batches;
+        recorded.gpuCulling = m_globalData->gpuCulling;
+        recorded.offsets = m_offsets;
+    }
+}
 
-    if (mesh->getVertices().size() == 0) {
+void PresentPass::record_gpu_culling(VkCommandBuffer cmd)
+{
+    FrameUploadRing& ring = m_globalData->uploadRing;
+    bool indirectCount = draws_indirect_count();
+
+    UploadAllocation instances = ring.allocate(ECS::MAX_ENTITIES * sizeof(GPUInstance), m_globalData->storageAlignment);
+    UploadAllocation draws = ring.allocate(ECS::MAX_ENTITIES * sizeof(VkDrawIndexedIndirectCommand), m_globalData->storageAlignment);
+    m_offsets.drawCommands = draws.offset;
+
+    // Every batch gets room for all of its instances, cull.comp counts up the ones that are visible. Without
+    // vkCmdDrawIndexedIndirectCount the first instance comes from the push constants instead, which needs no device feature.
+    GPUInstance* gpuInstances = (GPUInstance*)instances.data;
+    VkDrawIndexedIndirectCommand* drawCommands = (VkDrawIndexedIndirectCommand*)draws.data;
+    for (uint32_t b = 0; b < m_batches.size(); ++b) {
+        const DrawBatch& batch = m_batches[b];
+        const MeshData* mesh = batch.mesh;
+        drawCommands[b] = { mesh->indexRange.count, 0, mesh->indexRange.offset, (int32_t)mesh->vertexRange.offset,
+            indirectCount ? batch.firstInstance : 0 };
+
+        for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i) {
+            uint32_t eid = m_instances[i].second;
+            gpuInstances[i].model = m_modelMatrices[eid];
+            gpuInstances[i].sphere = m_worldSpheres[eid];
+            gpuInstances[i].batch = b;
+            gpuInstances[i].batchBase = batch.firstInstance;
+        }
+    }
+
+    UploadAllocation compacted {};
+    UploadAllocation counts {};
+    if (indirectCount) {
+        compacted = ring.allocate(ECS::MAX_ENTITIES * sizeof(VkDrawIndexedIndirectCommand), m_globalData->storageAlignment);
+        counts = ring.allocate(ECS::MAX_ENTITIES * sizeof(uint32_t), m_globalData->storageAlignment);
+        memset(counts.data, 0, m_blockDraws.size() * sizeof(uint32_t));
+
+        m_offsets.compactedDraws = compacted.offset;
+        m_offsets.drawCounts = counts.offset;
+    }
+
+    if (m_instances.empty()) {
         return;
     }
 
-    glm::mat4 view = m_globalData->camera.second.getTransform();
-    glm::mat4 projection = m_globalData->camera.first.getProjMatrix(m_globalData->windowSize.width, m_globalData->windowSize.height);
+    CullPushConstants constants;
+    for (int p = 0; p < 6; p++) {
+        constants.planes[p] = m_frustum.planes[p];
+    }
+    constants.instanceCount = (uint32_t)m_instances.size();
+
+    uint32_t dynamicOffsets[] = { (uint32_t)instances.offset, (uint32_t)draws.offset, m_offsets.scene[1] };
 
-    glm::mat4 model(1.0f);
-    Transform* t = e.get_component<Transform>().value();
-    if (e.get_component<Transform>().has_value()) {
-        model = e.get_component<Transform>().value()->getTransform();
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &m_cullDescriptor, 3, dynamicOffsets);
+    vkCmdPushConstants(cmd, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &constants);
+    vkCmdDispatch(cmd, (constants.instanceCount + 63) / 64, 1, 1);
+
+    VkMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+    if (indirectCount) {
+        // Drops the batches that ended up with no visible instances, so that each block is a single draw call
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        uint32_t compactOffsets[] = { (uint32_t)draws.offset, (uint32_t)compacted.offset, (uint32_t)counts.offset };
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_compactPipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &m_compactDescriptor, 3, compactOffsets);
+        for (uint32_t d = 0; d < m_blockDraws.size(); ++d) {
+            CompactPushConstants compact = { m_blockDraws[d].firstBatch, m_blockDraws[d].batchCount, d };
+            vkCmdPushConstants(cmd, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CompactPushConstants), &compact);
+            vkCmdDispatch(cmd, (compact.batchCount + 63) / 64, 1, 1);
+        }
     }
 
-    GPUCameraData camData;
-    camData.proj = projection;
-    camData.view = view;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
 
-    void* data;
-    vmaMapMemory(m_globalData->allocator, m_globalData->cameraData[m_globalData->frameIndex].allocation, &data);
-    memcpy(data, &camData, sizeof(GPUCameraData));
-    vmaUnmapMemory(m_globalData->allocator, m_globalData->cameraData[m_globalData->frameIndex].allocation);
+void PresentPass::record_commands(VkCommandBuffer cmd)
+{
+    int frame = m_globalData->frameIndex;
+    std::vector<VkCommandBuffer>& secondaryBuffers = m_secondaryBuffers[frame];
+
+    RecordedCommands& recorded = m_recorded[frame];
+    if (recorded.generation != m_drawListGeneration) {
+        std::vector<WorkerCommands>& workers = m_workerCommands[frame];
+        for (WorkerCommands& worker : workers) {
+            vkResetCommandPool(m_globalData->device, worker.pool, 0);
+            worker.recording = false;
+        }
 
-    vmaMapMemory(m_globalData->allocator, m_globalData->sceneData[m_globalData->frameIndex].allocation, &data);
-    data = (void*)((char*)data + e.get_eid() * sizeof(glm::mat4));
-    memcpy(data, &model, sizeof(glm::mat4));
-    vmaUnmapMemory(m_globalData->allocator, m_globalData->sceneData[m_globalData->frameIndex].allocation);
+        // With vkCmdDrawIndexedIndirectCount there is one draw per block, otherwise one per batch
+        bool indirectCount = draws_indirect_count();
+        size_t drawCount = indirectCount ? m_blockDraws.size() : m_batches.size();
+
+        // A worker can be handed several ranges, which all go into its one secondary buffer
+        m_jobs.parallel_for(drawCount, 64, [this, &workers, indirectCount](size_t begin, size_t end, size_t workerIndex) {
+            WorkerCommands& worker = workers[workerIndex];
+            if (!worker.recording) {
+                begin_secondary_commands(worker);
+                worker.recording = true;
+            }
+
+            for (size_t i = begin; i < end; ++i) {
+                if (indirectCount) {
+                    record_block_commands(worker, i);
+                } else {
+                    record_batch_commands(worker, i);
+                }
+            }
+        });
+
+        secondaryBuffers.clear();
+        for (WorkerCommands& worker : workers) {
+            if (worker.recording) {
+                vkEndCommandBuffer(worker.buffer);
+                secondaryBuffers.push_back(worker.buffer);
+            }
+        }
 
+        recorded.generation = m_drawListGeneration;
+        m_globalData->commandRecordings++;
+    }
+
+    if (!secondaryBuffers.empty()) {
+        vkCmdExecuteCommands(cmd, (uint32_t)secondaryBuffers.size(), secondaryBuffers.data());
+    }
+}
+
+void PresentPass::begin_secondary_commands(WorkerCommands& worker)
+{
+    VkCommandBufferInheritanceInfo inheritanceInfo {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = m_passData.renderPass;
+    inheritanceInfo.subpass = 0;
+    // Left out so that the buffer can be executed again with whichever swapchain image comes up
+    inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(worker.buffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin secondary command buffer");
+    }
+
+    // Secondary buffers inherit none of the primary's state
+    VkViewport viewport {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)m_extent.width;
+    viewport.height = (float)m_extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor {};
+    scissor.offset = { 0, 0 };
+    scissor.extent = m_extent;
+
+    vkCmdSetViewport(worker.buffer, 0, 1, &viewport);
+    vkCmdSetScissor(worker.buffer, 0, 1, &scissor);
+
+    // The pipelines of all layouts share the pipeline layout, so this stays bound across bind_geometry_blocks
+    vkCmdBindDescriptorSets(worker.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_passData.pipelineLayout,
+        0, 1, &m_globalData->globalDescriptor, 2, m_offsets.scene);
+
+    worker.boundLayout.reset();
+    worker.boundVertexBlock = UINT32_MAX;
+    worker.boundIndexBlock = UINT32_MAX;
+}
+
+void PresentPass::bind_geometry_blocks(WorkerCommands& worker, VertexLayout layout, uint32_t vertexBlock, uint32_t indexBlock)
+{
+    if (worker.boundLayout != layout) {
+        vkCmdBindPipeline(worker.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_passData.pipelines[(size_t)layout]);
+        worker.boundLayout = layout;
+        // Block numbers are per layout arena
+        worker.boundVertexBlock = UINT32_MAX;
+    }
+
+    if (worker.boundVertexBlock != vertexBlock) {
+        VkBuffer buffer = m_globalData->vertexArenas[(size_t)layout].get_buffer(vertexBlock);
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(worker.buffer, 0, 1, &buffer, &offset);
+        worker.boundVertexBlock = vertexBlock;
+    }
+
+    if (worker.boundIndexBlock != indexBlock) {
+        vkCmdBindIndexBuffer(worker.buffer, m_globalData->indexArena.get_buffer(indexBlock), 0, VK_INDEX_TYPE_UINT32);
+        worker.boundIndexBlock = indexBlock;
+    }
+}
+
+void PresentPass::record_batch_commands(WorkerCommands& worker, size_t batchIndex)
+{
+    const DrawBatch& batch = m_batches[batchIndex];
+    const MeshData* mesh = batch.mesh;
+
+    MeshPushConstants constants;
+    constants.baseInstance = batch.firstInstance;
+
+    vkCmdPushConstants(worker.buffer, m_passData.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+    bind_geometry_blocks(worker, mesh->layout, mesh->vertexRange.block, mesh->indexRange.block);
+
+    if (m_globalData->gpuCulling) {
+        vkCmdDrawIndexedIndirect(worker.buffer, m_globalData->uploadRing.get_buffer(),
+            m_offsets.drawCommands + batchIndex * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+        vkCmdDrawIndexed(worker.buffer, mesh->indexRange.count, batch.instanceCount, mesh->indexRange.offset,
+            (int32_t)mesh->vertexRange.offset, 0);
+    }
+}
+
+void PresentPass::record_block_commands(WorkerCommands& worker, size_t blockDrawIndex)
+{
+    const BlockDraw& blockDraw = m_blockDraws[blockDrawIndex];
+
+    // The draw commands carry the first instance themselves
     MeshPushConstants constants;
-    constants.index = e.get_eid();
+    constants.baseInstance = 0;
 
-    vkCmdPushConstants(cmd, m_passData.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+    vkCmdPushConstants(worker.buffer, m_passData.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+    bind_geometry_blocks(worker, blockDraw.layout, blockDraw.vertexBlock, blockDraw.indexBlock);
+
+    VkBuffer ring = m_globalData->uploadRing.get_buffer();
+    vkCmdDrawIndexedIndirectCount(worker.buffer,
+        ring, m_offsets.compactedDraws + blockDraw.firstBatch * sizeof(VkDrawIndexedIndirectCommand),
+        ring, m_offsets.drawCounts + blockDrawIndex * sizeof(uint32_t),
+        blockDraw.batchCount, sizeof(VkDrawIndexedIndirectCommand));
+}
 
-    VkDeviceSize offset = 0;
-    vkCmdBindVertexBuffers(cmd, 0, 1, &mesh->m_buffer.buffer, &offset);
-    vkCmdDraw(cmd, mesh->m_vertices.size(), 1, 0, 0);
+bool PresentPass::draws_indirect_count() const
+{
+    return m_globalData->gpuCulling && m_globalData->drawIndirectCount;
+}
+
+void PresentPass::record_readback(VkCommandBuffer cmd)
+{
+    VkBufferImageCopy region {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { m_extent.width, m_extent.height, 1 };
+
+    vkCmdCopyImageToBuffer(cmd, m_passData.images[m_globalData->swapchainIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        m_readbackBuffers[m_globalData->frameIndex].buffer, 1, &region);
+
+    VkBufferMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_readbackBuffers[m_globalData->frameIndex].buffer;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void PresentPass::read_pixels(std::vector<uint8_t>& rgba)
+{
+    if (!m_globalData->headless || !m_globalData->readback) {
+        throw std::runtime_error("Reading pixels back needs a headless renderer with readback enabled");
+    }
+    if (m_lastSubmittedFrame < 0) {
+        throw std::runtime_error("No frame has been rendered yet");
+    }
+
+    vkWaitForFences(m_globalData->device, 1, &m_passData.inFlightFences[m_lastSubmittedFrame], VK_TRUE, UINT64_MAX);
+
+    AllocatedBuffer& buffer = m_readbackBuffers[m_lastSubmittedFrame];
+    rgba.resize((size_t)m_extent.width * m_extent.height * 4);
+
+    void* data;
+    vmaMapMemory(m_globalData->allocator, buffer.allocation, &data);
+    vmaInvalidateAllocation(m_globalData->allocator, buffer.allocation, 0, VK_WHOLE_SIZE);
+    memcpy(rgba.data(), data, rgba.size());
+    vmaUnmapMemory(m_globalData->allocator, buffer.allocation);
 }
@@ -13,11 +13,66 @@
 
 #include <Camera.hpp>
 #include <ECS/ECS.hpp>
+#include <JobSystem.hpp>
 #include <Mesh.hpp>
+#include <Renderer/Culling.hpp>
 #include <Renderer/RenderPass.hpp>
 #include <Transform.hpp>
 
-class GlobalRenderContext;
+struct GlobalRenderContext;
+
+// Instances of one mesh, drawn with a single instanced draw
+struct DrawBatch {
+    bool operator==(const DrawBatch& other) const = default;
+
+    const MeshData* mesh;
+    uint64_t meshId;
+    // Index of the first instance's model matrix in the scene buffer
+    uint32_t firstInstance;
+    // With GPU culling only an upper bound, the draw command holds how many were visible
+    uint32_t instanceCount;
+};
+
+// Consecutive batches with the same vertex layout whose vertices and indices are in the same arena blocks, drawn with
+// one vkCmdDrawIndexedIndirectCount
+struct BlockDraw {
+    VertexLayout layout;
+    uint32_t vertexBlock;
+    uint32_t indexBlock;
+    uint32_t firstBatch;
+    uint32_t batchCount;
+};
+
+// Where this frame's data was put in the upload ring
+struct FrameOffsets {
+    bool operator==(const FrameOffsets& other) const = default;
+
+    // Dynamic offsets of the camera and scene bindings
+    uint32_t scene[2] = {};
+    // Indirect draw commands written by cull.comp, one per batch
+    VkDeviceSize drawCommands = 0;
+    // The commands with visible instances, packed per block by compact.comp, and how many there are per block
+    VkDeviceSize compactedDraws = 0;
+    VkDeviceSize drawCounts = 0;
+};
+
+// The state the secondary command buffers of one frame in flight were last recorded with
+struct RecordedCommands {
+    uint64_t generation = 0;
+    std::vector<DrawBatch> batches;
+    bool gpuCulling = false;
+    FrameOffsets offsets;
+};
+
+// Command pool and secondary command buffer of one recording thread for one frame in flight
+struct WorkerCommands {
+    VkCommandPool pool;
+    VkCommandBuffer buffer;
+    bool recording = false;
+    std::optional<VertexLayout> boundLayout;
+    uint32_t boundVertexBlock = UINT32_MAX;
+    uint32_t boundIndexBlock = UINT32_MAX;
+};
 
 class PresentPass : RenderPass {
 public:
@@ -37,15 +92,46 @@ public:
     void set_global_context(std::shared_ptr<GlobalRenderContext> globalData) { m_globalData = globalData; }
 
     void create_swapchain(bool recreation);
+    void create_offscreen_targets();
     void create_render_pass();
     void create_framebuffers(bool recreation);
     void create_pipelines();
+    void create_cull_pipeline();
     void create_sync_objects();
+    void create_worker_commands();
+
+    VkShaderModule load_shader_module(const std::string& filename);
+
+    // Computes the model matrix, mesh and world bounding sphere of every entity with a Mesh
+    void gather_instances();
+    // Fills m_visibleEntities with the entities whose mesh is inside the camera frustum
+    void cull_entities();
+    // Groups eids into m_batches by mesh and the batches into m_blockDraws by vertex layout and arena blocks, leaving
+    // m_instances in draw order
+    void build_batches(const std::vector<uint32_t>& eids);
+
+    // Uploads this frame's data and culls, on the CPU or by recording the cull dispatch. Comes before the render pass
+    void prepare_frame(VkCommandBuffer cmd);
+    void record_gpu_culling(VkCommandBuffer cmd);
 
+    // Splits the batches between the job system's workers, which record them into secondary command buffers that
+    // cmd then executes. The secondary buffers are kept and executed again as long as the draw list doesn't change.
     void record_commands(VkCommandBuffer cmd);
-    void record_entity_commands(VkCommandBuffer cmd, ECS::Entity& e);
+    // Forces the secondary command buffers to be recorded again
+    void invalidate_recorded_commands() { ++m_drawListGeneration; }
+    void begin_secondary_commands(WorkerCommands& worker);
+    // Binds the pipeline of layout along with the blocks, skipping whatever is already bound
+    void bind_geometry_blocks(WorkerCommands& worker, VertexLayout layout, uint32_t vertexBlock, uint32_t indexBlock);
+    void record_batch_commands(WorkerCommands& worker, size_t batchIndex);
+    void record_block_commands(WorkerCommands& worker, size_t blockDrawIndex);
+    void record_readback(VkCommandBuffer cmd);
+
+    void read_pixels(std::vector<uint8_t>& rgba);
 
 private:
+    // Whether the GPU culling results are drawn per block with vkCmdDrawIndexedIndirectCount rather than per batch
+    bool draws_indirect_count() const;
+
     ECS::EntityManager m_em;
 
     std::shared_ptr<GlobalRenderContext> m_globalData;
@@ -53,6 +139,52 @@ private:
     PassData m_passData;
     vkb::Swapchain m_swapchain;
 
+    // Size and format of the images drawn to, whether they come from the swapchain or are offscreen
+    VkExtent2D m_extent {};
+    VkFormat m_colorFormat = VK_FORMAT_UNDEFINED;
+
+    // Headless mode only
+    std::vector<AllocatedImage> m_offscreenImages;
+    std::vector<AllocatedBuffer> m_readbackBuffers;
+    int m_lastSubmittedFrame = -1;
+
+    JobSystem m_jobs;
+    CullingSpheres m_cullingSpheres;
+    std::vector<uint32_t> m_meshEntities;
+    std::vector<uint32_t> m_visibleEntities;
+    // Model matrices, meshes and world bounding spheres of this frame indexed by eid, filled in by gather_instances
+    std::vector<glm::mat4> m_modelMatrices = std::vector<glm::mat4>(ECS::MAX_ENTITIES);
+    std::vector<const MeshData*> m_meshData = std::vector<const MeshData*>(ECS::MAX_ENTITIES);
+    std::vector<glm::vec4> m_worldSpheres = std::vector<glm::vec4>(ECS::MAX_ENTITIES);
+
+    std::vector<std::pair<const MeshData*, uint32_t>> m_instances;
+    std::vector<DrawBatch> m_batches;
+    std::vector<BlockDraw> m_blockDraws;
+
+    Frustum m_frustum;
+    // This frame's model matrices in the upload ring, in batch order
+    glm::mat4* m_frameModels = nullptr;
+    FrameOffsets m_offsets;
+
+    // Indexed by frame in flight, then by worker
+    std::vector<std::vector<WorkerCommands>> m_workerCommands;
+    std::vector<std::vector<VkCommandBuffer>> m_secondaryBuffers;
+
+    // Goes up whenever all secondary buffers have to be recorded again, like after recreating the swapchain
+    uint64_t m_drawListGeneration = 1;
+    // What the secondary buffers of each frame in flight were recorded with. Everything kept in the upload ring, like
+    // the camera and the model matrices, is only referenced by offset, so only the batches, the culling mode and the
+    // offsets count. The offsets differ between frames since each has its own region of the ring.
+    std::vector<RecordedCommands> m_recorded;
+
+    VkDescriptorSetLayout m_cullSetLayout;
+    VkDescriptorSet m_cullDescriptor;
+    VkPipelineLayout m_cullPipelineLayout;
+    VkPipeline m_cullPipeline;
+    // compact.comp shares the cull set and pipeline layouts
+    VkDescriptorSet m_compactDescriptor;
+    VkPipeline m_compactPipeline;
+
     std::deque<std::function<void()>> m_cleanupQueue;
 
     friend class Renderer;
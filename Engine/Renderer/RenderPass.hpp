@@ -4,7 +4,8 @@
 struct PassData {
     VkRenderPass renderPass;
 
-    VkPipeline pipeline;
+    // Indexed by VertexLayout, all sharing pipelineLayout
+    std::vector<VkPipeline> pipelines;
     VkPipelineLayout pipelineLayout;
 
     std::vector<VkImage> images;
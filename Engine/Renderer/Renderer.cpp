@@ -2,17 +2,29 @@
 
 #include <Renderer/VulkanInitializers.hpp>
 
+void GlobalRenderContext::destroy_pending(bool all)
+{
+    while (!pendingDestroys.empty() && (all || pendingDestroys.front().first + MAX_FRAMES_IN_FLIGHT <= frameNumber)) {
+        pendingDestroys.front().second();
+        pendingDestroys.pop_front();
+    }
+}
+
 void Renderer::init()
 {
-    int w, h;
-    SDL_GetWindowSize(m_window, &w, &h);
-    m_globalData->windowSize = { (uint32_t)w, (uint32_t)h };
+    if (!m_globalData->headless) {
+        int w, h;
+        SDL_GetWindowSize(m_window, &w, &h);
+        m_globalData->windowSize = { (uint32_t)w, (uint32_t)h };
+    }
 
     m_presentPass.set_global_context(m_globalData);
 
     init_instance();
     m_presentPass.create_swapchain(false);
     init_global_descriptor();
+    init_geometry_arena();
+    init_uploads();
     init_render_passes();
     prepare_resources();
     create_command_buffers();
@@ -22,21 +34,25 @@ void Renderer::init()
 
 void Renderer::update()
 {
-    int w, h;
-    SDL_GetWindowSize(m_window, &w, &h);
-    if (w != m_globalData->windowSize.width || h != m_globalData->windowSize.height) {
-        recreate_swapchain();
-        m_globalData->windowSize.width = w;
-        m_globalData->windowSize.height = h;
-    }
-    if (SDL_GetWindowFlags(m_window) & SDL_WINDOW_MINIMIZED) {
-        return;
+    if (!m_globalData->headless) {
+        int w, h;
+        SDL_GetWindowSize(m_window, &w, &h);
+        if (w != m_globalData->windowSize.width || h != m_globalData->windowSize.height) {
+            recreate_swapchain();
+            m_globalData->windowSize.width = w;
+            m_globalData->windowSize.height = h;
+        }
+        if (SDL_GetWindowFlags(m_window) & SDL_WINDOW_MINIMIZED) {
+            return;
+        }
     }
 
     m_presentPass.update();
 
     m_globalData->frameIndex = (m_globalData->frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
     m_globalData->frameNumber++;
+
+    m_globalData->destroy_pending(false);
 }
 
 void Renderer::exit()
@@ -59,6 +75,11 @@ void Renderer::recreate_swapchain()
     create_command_buffers();
 }
 
+void Renderer::read_pixels(std::vector<uint8_t>& rgba)
+{
+    m_presentPass.read_pixels(rgba);
+}
+
 std::shared_ptr<GlobalRenderContext> Renderer::get_global_data()
 {
     return m_globalData;
@@ -67,7 +88,15 @@ std::shared_ptr<GlobalRenderContext> Renderer::get_global_data()
 void Renderer::init_instance()
 {
     vkb::InstanceBuilder instanceBuilder;
-    auto instanceRet = instanceBuilder.use_default_debug_messenger().request_validation_layers().build();
+    instanceBuilder.use_default_debug_messenger().request_validation_layers();
+    // Timeline semaphores and vkCmdDrawIndexedIndirectCount are core in 1.2
+    instanceBuilder.require_api_version(1, 2, 0);
+    if (m_globalData->headless) {
+        // Leaves out the surface extensions, which software drivers without a display may not have
+        instanceBuilder.set_headless();
+    }
+
+    auto instanceRet = instanceBuilder.build();
     if (!instanceRet) {
         throw std::runtime_error("Failed to create Vulkan instance");
     }
@@ -77,15 +106,40 @@ void Renderer::init_instance()
         vkb::destroy_instance(m_globalData->instance);
     });
 
-    if (SDL_Vulkan_CreateSurface(m_window, m_globalData->instance, &m_surface) == SDL_FALSE) {
-        throw std::runtime_error("Failed to create window surface");
+    vkb::PhysicalDeviceSelector selector(m_globalData->instance);
+    if (!m_globalData->headless) {
+        if (SDL_Vulkan_CreateSurface(m_window, m_globalData->instance, &m_surface) == SDL_FALSE) {
+            throw std::runtime_error("Failed to create window surface");
+        }
+        m_cleanupQueue.push_front([this]() {
+            vkDestroySurfaceKHR(m_globalData->instance, m_surface, nullptr);
+        });
+
+        selector.set_surface(m_surface);
     }
-    m_cleanupQueue.push_front([this]() {
-        vkDestroySurfaceKHR(m_globalData->instance, m_surface, nullptr);
-    });
 
-    vkb::PhysicalDeviceSelector selector(m_globalData->instance);
-    auto physDeviceRet = selector.set_surface(m_surface).select();
+    // The upload manager signals the graphics queue with a timeline semaphore
+    VkPhysicalDeviceVulkan12Features requiredFeatures12 {};
+    requiredFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    requiredFeatures12.timelineSemaphore = VK_TRUE;
+    selector.set_minimum_version(1, 2).set_required_features_12(requiredFeatures12);
+
+    // Prefer a device that can draw every mesh in a pair of arena blocks with one vkCmdDrawIndexedIndirectCount
+    VkPhysicalDeviceFeatures indirectFeatures {};
+    indirectFeatures.multiDrawIndirect = VK_TRUE;
+    indirectFeatures.drawIndirectFirstInstance = VK_TRUE;
+
+    VkPhysicalDeviceVulkan12Features indirectFeatures12 = requiredFeatures12;
+    indirectFeatures12.drawIndirectCount = VK_TRUE;
+
+    vkb::PhysicalDeviceSelector indirectSelector = selector;
+    indirectSelector.set_required_features(indirectFeatures).set_required_features_12(indirectFeatures12);
+
+    auto physDeviceRet = indirectSelector.select();
+    m_globalData->drawIndirectCount = physDeviceRet.has_value();
+    if (!physDeviceRet) {
+        physDeviceRet = selector.select();
+    }
     if (!physDeviceRet) {
         throw std::runtime_error("No suitable GPUs found");
     }
@@ -102,12 +156,21 @@ void Renderer::init_instance()
     });
 
     auto gq = m_globalData->device.get_queue(vkb::QueueType::graphics);
-    auto pq = m_globalData->device.get_queue(vkb::QueueType::present);
-    if (!gq.has_value() || !pq.has_value()) {
+    if (!gq.has_value()) {
         throw std::runtime_error("Failed to find queues");
     }
     m_globalData->graphicsQueue = gq.value();
-    m_globalData->presentQueue = pq.value();
+
+    // Without a surface there is nothing to present to
+    if (m_globalData->headless) {
+        m_globalData->presentQueue = m_globalData->graphicsQueue;
+    } else {
+        auto pq = m_globalData->device.get_queue(vkb::QueueType::present);
+        if (!pq.has_value()) {
+            throw std::runtime_error("Failed to find queues");
+        }
+        m_globalData->presentQueue = pq.value();
+    }
 
     VmaAllocatorCreateInfo allocatorInfo {};
     allocatorInfo.physicalDevice = physDeviceRet.value();
@@ -121,21 +184,16 @@ void Renderer::init_instance()
 
 void Renderer::init_global_descriptor()
 {
-    m_globalData->cameraData.resize(m_globalData->numSwapchainImages);
-    m_globalData->sceneData.resize(m_globalData->numSwapchainImages);
-
-    m_globalData->globalDescriptor.resize(m_globalData->numSwapchainImages);
-
     VkDescriptorSetLayoutBinding camBufferBinding {};
     camBufferBinding.binding = 0;
     camBufferBinding.descriptorCount = 1;
-    camBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    camBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     camBufferBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     VkDescriptorSetLayoutBinding sceneBufferBinding {};
     sceneBufferBinding.binding = 1;
     sceneBufferBinding.descriptorCount = 1;
-    sceneBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    sceneBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
     sceneBufferBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     VkDescriptorSetLayoutBinding bindings[] = { camBufferBinding, sceneBufferBinding };
@@ -149,8 +207,8 @@ void Renderer::init_global_descriptor()
     vkCreateDescriptorSetLayout(m_globalData->device, &globalSetInfo, nullptr, &m_globalData->globalSetLayout);
 
     std::vector<VkDescriptorPoolSize> sizes = {
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 }
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10 },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 10 }
     };
 
     VkDescriptorPoolCreateInfo poolInfo {};
@@ -167,56 +225,77 @@ void Renderer::init_global_descriptor()
         vkDestroyDescriptorPool(m_globalData->device, m_globalData->descriptorPool, nullptr);
     });
 
-    for (int i = 0; i < m_globalData->numSwapchainImages; i++) {
-        m_globalData->cameraData[i] = create_buffer(&m_globalData->allocator,
-            sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    const VkPhysicalDeviceLimits& limits = m_globalData->device.physical_device.properties.limits;
+    m_globalData->uniformAlignment = limits.minUniformBufferOffsetAlignment;
+    m_globalData->storageAlignment = limits.minStorageBufferOffsetAlignment;
 
-        m_globalData->sceneData[i] = create_buffer(&m_globalData->allocator,
-            ECS::MAX_ENTITIES * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    m_globalData->uploadRing.init(&m_globalData->allocator, UPLOAD_RING_FRAME_SIZE, MAX_FRAMES_IN_FLIGHT,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    m_cleanupQueue.push_front([this]() {
+        m_globalData->uploadRing.cleanup();
+    });
 
-        m_cleanupQueue.push_front([this, i]() {
-            vmaDestroyBuffer(m_globalData->allocator, m_globalData->cameraData[i].buffer, m_globalData->cameraData[i].allocation);
-            vmaDestroyBuffer(m_globalData->allocator, m_globalData->sceneData[i].buffer, m_globalData->sceneData[i].allocation);
-        });
+    VkDescriptorSetAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_globalData->descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_globalData->globalSetLayout;
+
+    vkAllocateDescriptorSets(m_globalData->device, &allocInfo, &m_globalData->globalDescriptor);
+
+    VkDescriptorBufferInfo camBufInfo {};
+    camBufInfo.buffer = m_globalData->uploadRing.get_buffer();
+    camBufInfo.offset = 0;
+    camBufInfo.range = sizeof(GPUCameraData);
+
+    VkWriteDescriptorSet camSetWrite {};
+    camSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    camSetWrite.dstBinding = 0;
+    camSetWrite.dstSet = m_globalData->globalDescriptor;
+    camSetWrite.descriptorCount = 1;
+    camSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    camSetWrite.pBufferInfo = &camBufInfo;
+
+    VkDescriptorBufferInfo sceneBufInfo {};
+    sceneBufInfo.buffer = m_globalData->uploadRing.get_buffer();
+    sceneBufInfo.offset = 0;
+    sceneBufInfo.range = ECS::MAX_ENTITIES * sizeof(glm::mat4);
+
+    VkWriteDescriptorSet sceneSetWrite {};
+    sceneSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    sceneSetWrite.dstBinding = 1;
+    sceneSetWrite.dstSet = m_globalData->globalDescriptor;
+    sceneSetWrite.descriptorCount = 1;
+    sceneSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    sceneSetWrite.pBufferInfo = &sceneBufInfo;
+
+    VkWriteDescriptorSet setWrites[] = { camSetWrite, sceneSetWrite };
+
+    vkUpdateDescriptorSets(m_globalData->device, 2, setWrites, 0, nullptr);
+}
 
-        VkDescriptorSetAllocateInfo allocInfo {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = m_globalData->descriptorPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = &m_globalData->globalSetLayout;
-
-        vkAllocateDescriptorSets(m_globalData->device, &allocInfo, &m_globalData->globalDescriptor[i]);
-
-        VkDescriptorBufferInfo camBufInfo {};
-        camBufInfo.buffer = m_globalData->cameraData[i].buffer;
-        camBufInfo.offset = 0;
-        camBufInfo.range = sizeof(GPUCameraData);
-
-        VkWriteDescriptorSet camSetWrite {};
-        camSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        camSetWrite.dstBinding = 0;
-        camSetWrite.dstSet = m_globalData->globalDescriptor[i];
-        camSetWrite.descriptorCount = 1;
-        camSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        camSetWrite.pBufferInfo = &camBufInfo;
-
-        VkDescriptorBufferInfo sceneBufInfo {};
-        sceneBufInfo.buffer = m_globalData->sceneData[i].buffer;
-        sceneBufInfo.offset = 0;
-        sceneBufInfo.range = ECS::MAX_ENTITIES * sizeof(glm::mat4);
-
-        VkWriteDescriptorSet sceneSetWrite {};
-        sceneSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        sceneSetWrite.dstBinding = 1;
-        sceneSetWrite.dstSet = m_globalData->globalDescriptor[i];
-        sceneSetWrite.descriptorCount = 1;
-        sceneSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        sceneSetWrite.pBufferInfo = &sceneBufInfo;
-
-        VkWriteDescriptorSet setWrites[] = { camSetWrite, sceneSetWrite };
-
-        vkUpdateDescriptorSets(m_globalData->device, 2, setWrites, 0, nullptr);
+void Renderer::init_geometry_arena()
+{
+    for (size_t layout = 0; layout < VERTEX_LAYOUT_COUNT; ++layout) {
+        m_globalData->vertexArenas[layout].init(&m_globalData->allocator, get_vertex_size((VertexLayout)layout), VERTEX_ARENA_BLOCK_SIZE,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
     }
+    m_globalData->indexArena.init(&m_globalData->allocator, sizeof(uint32_t), INDEX_ARENA_BLOCK_SIZE,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    m_cleanupQueue.push_front([this]() {
+        m_globalData->indexArena.cleanup();
+        for (GeometryArena& arena : m_globalData->vertexArenas) {
+            arena.cleanup();
+        }
+    });
+}
+
+void Renderer::init_uploads()
+{
+    m_globalData->uploads.init(m_globalData->device, &m_globalData->allocator, STAGING_RING_SIZE);
+    m_cleanupQueue.push_front([this]() {
+        m_globalData->uploads.cleanup();
+    });
 }
 
 void Renderer::init_render_passes()
@@ -271,7 +350,14 @@ void Renderer::create_command_buffers()
             throw std::runtime_error("Failed to allocate command buffers");
         }
 
+        VkFenceCreateInfo fenceInfo {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(m_globalData->device, &fenceInfo, nullptr, &m_uploadData->uploadFence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload fence");
+        }
+
         m_cleanupQueue.push_front([this]() {
+            vkDestroyFence(m_globalData->device, m_uploadData->uploadFence, nullptr);
             vkDestroyCommandPool(m_globalData->device, m_uploadData->commandPool, nullptr);
         });
     }
@@ -3,10 +3,14 @@
 #include <SDL.h>
 #include <SDL_vulkan.h>
 
+#include <Renderer/FrameUploadRing.hpp>
+#include <Renderer/GeometryArena.hpp>
 #include <Renderer/PresentPass.hpp>
+#include <Renderer/UploadManager.hpp>
 
 struct MeshPushConstants {
-    uint32_t index;
+    // Added to gl_InstanceIndex to find an instance's model matrix
+    uint32_t baseInstance;
 };
 
 struct GPUCameraData {
@@ -14,6 +18,29 @@ struct GPUCameraData {
     glm::mat4 proj;
 };
 
+// Input of cull.comp, one per entity with a Mesh
+struct GPUInstance {
+    glm::mat4 model;
+    // World space bounding sphere with the radius in w
+    glm::vec4 sphere;
+    // Index of the batch's draw command and of its first model matrix in the scene buffer
+    uint32_t batch;
+    uint32_t batchBase;
+    uint32_t padding[2];
+};
+
+struct CullPushConstants {
+    glm::vec4 planes[6];
+    uint32_t instanceCount;
+};
+
+// compact.comp runs once per BlockDraw
+struct CompactPushConstants {
+    uint32_t firstBatch;
+    uint32_t batchCount;
+    uint32_t blockDraw;
+};
+
 struct GlobalRenderContext {
     std::pair<Camera, Transform> camera;
 
@@ -27,22 +54,54 @@ struct GlobalRenderContext {
 
     VkDescriptorPool descriptorPool;
 
+    // The camera and scene bindings are dynamic and point into uploadRing, so one set serves every frame
     VkDescriptorSetLayout globalSetLayout;
-    std::vector<VkDescriptorSet> globalDescriptor;
+    VkDescriptorSet globalDescriptor;
+
+    FrameUploadRing uploadRing;
+    VkDeviceSize uniformAlignment;
+    VkDeviceSize storageAlignment;
 
-    std::vector<AllocatedBuffer> cameraData;
-    std::vector<AllocatedBuffer> sceneData;
+    // Hold the vertices and indices of every mesh, in device-local memory written through uploads. One vertex arena
+    // per VertexLayout since the stride differs.
+    GeometryArena vertexArenas[VERTEX_LAYOUT_COUNT];
+    GeometryArena indexArena;
+    UploadManager uploads;
 
     VkCommandPool commandPool;
     std::vector<VkCommandBuffer> commandBuffers;
 
     VkExtent2D windowSize;
 
+    // Rendering into offscreen images without a window, surface or swapchain
+    bool headless = false;
+    // Copy every headless frame back to host memory for Renderer::read_pixels
+    bool readback = false;
+
+    // Cull with a compute shader that also fills in the instance counts of indirect draws, instead of on the CPU
+    bool gpuCulling = true;
+    // Set when the device supports vkCmdDrawIndexedIndirectCount with multi-draw and firstInstance. GPU culling then
+    // draws everything in a pair of arena blocks with one call instead of one indirect draw per mesh.
+    bool drawIndirectCount = false;
+
+    // How far between the previous and the current simulation tick to render entities with a PreviousTransform
+    float interpolationAlpha = 1.0f;
+
     int frameIndex = 0;
     size_t frameNumber = 0;
+    // How often the secondary command buffers were recorded, which should only happen when the draws change
+    size_t commandRecordings = 0;
 
     size_t numSwapchainImages = 0;
     uint32_t swapchainIndex = 0;
+
+    // Queues the destruction of something that frames in flight may still use, to run once they are done
+    void destroy_later(std::function<void()> destroy) { pendingDestroys.emplace_back(frameNumber, std::move(destroy)); }
+    // Runs the queued destructions no frame in flight can be affected by anymore, or all of them once the device
+    // is idle
+    void destroy_pending(bool all);
+
+    std::deque<std::pair<size_t, std::function<void()>>> pendingDestroys;
 };
 
 struct UploadContext {
@@ -52,6 +111,14 @@ struct UploadContext {
 };
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
+// Room for the per-frame data of one frame in flight in the upload ring
+const VkDeviceSize UPLOAD_RING_FRAME_SIZE = 4 * 1024 * 1024;
+// Vertices per vertex arena block, 36 MiB worth with the float layout and 16 MiB quantized
+const uint32_t VERTEX_ARENA_BLOCK_SIZE = 1024 * 1024;
+// Indices per index arena block, 16 MiB worth
+const uint32_t INDEX_ARENA_BLOCK_SIZE = 4 * 1024 * 1024;
+// Bigger uploads are split up and streamed through it over several submissions
+const VkDeviceSize STAGING_RING_SIZE = 16 * 1024 * 1024;
 
 class Renderer {
 public:
@@ -62,17 +129,35 @@ public:
         m_uploadData = std::make_shared<UploadContext>();
     }
 
+    // Headless renderer that draws width x height frames into offscreen images. Doesn't need SDL or a display, so
+    // it can run on build machines with a software driver such as lavapipe.
+    Renderer(uint32_t width, uint32_t height, bool readback = false)
+        : m_window(nullptr)
+    {
+        m_globalData = std::make_shared<GlobalRenderContext>();
+        m_uploadData = std::make_shared<UploadContext>();
+
+        m_globalData->windowSize = { width, height };
+        m_globalData->headless = true;
+        m_globalData->readback = readback;
+    }
+
     void init();
     void update();
     void exit();
 
     void recreate_swapchain();
 
+    // Tightly packed RGBA8 pixels of the last headless frame, waiting for it to finish first. Needs readback.
+    void read_pixels(std::vector<uint8_t>& rgba);
+
     std::shared_ptr<GlobalRenderContext> get_global_data();
 
     void init_instance();
     void init_render_passes();
     void init_global_descriptor();
+    void init_geometry_arena();
+    void init_uploads();
     void prepare_resources();
     void create_command_buffers();
     void bind_global_descriptor();
@@ -94,7 +179,7 @@ private:
 
     bool m_initialized = false;
 
-    VkSurfaceKHR m_surface;
+    VkSurfaceKHR m_surface = VK_NULL_HANDLE;
 
     std::vector<PresentPass> m_renderPasses;
     PresentPass m_presentPass;
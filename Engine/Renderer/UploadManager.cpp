@@ -0,0 +1,264 @@
+#include "UploadManager.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void UploadManager::init(vkb::Device& device, VmaAllocator* allocator, VkDeviceSize stagingSize)
+{
+    m_device = device;
+    m_allocator = allocator;
+    m_stagingSize = stagingSize;
+
+    m_graphicsFamily = device.get_queue_index(vkb::QueueType::graphics).value();
+
+    // A transfer-only queue runs the copies on the DMA engines, next to the rendering
+    auto transferQueue = device.get_dedicated_queue(vkb::QueueType::transfer);
+    if (transferQueue.has_value()) {
+        m_queue = transferQueue.value();
+        m_queueFamily = device.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    } else {
+        m_queue = device.get_queue(vkb::QueueType::graphics).value();
+        m_queueFamily = m_graphicsFamily;
+    }
+
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stagingSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo vmaAllocInfo {};
+    vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocationInfo;
+    if (vmaCreateBuffer(*allocator, &bufferInfo, &vmaAllocInfo, &m_staging.buffer, &m_staging.allocation, &allocationInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate staging ring");
+    }
+
+    m_staging.allocator = allocator;
+    m_staging.inUse = true;
+    m_mapped = (char*)allocationInfo.pMappedData;
+
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = m_queueFamily;
+
+    if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload command pool");
+    }
+
+    VkSemaphoreTypeCreateInfo typeInfo {};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_timeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload timeline semaphore");
+    }
+}
+
+void UploadManager::cleanup()
+{
+    if (!m_staging.inUse) {
+        return;
+    }
+
+    vkDestroySemaphore(m_device, m_timeline, nullptr);
+    vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    vmaDestroyBuffer(*m_allocator, m_staging.buffer, m_staging.allocation);
+
+    m_staging.inUse = false;
+    m_mapped = nullptr;
+    m_inFlight.clear();
+    m_freeCommandBuffers.clear();
+}
+
+void UploadManager::upload(VkBuffer dst, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    // Split up so that no piece can need more than the whole ring
+    const VkDeviceSize maxChunk = m_stagingSize / 2;
+
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        VkDeviceSize chunk = std::min(size, maxChunk);
+        VkDeviceSize stagingOffset = reserve(chunk);
+        memcpy(m_mapped + stagingOffset, bytes, chunk);
+
+        m_copies.push_back({ dst, { stagingOffset, offset, chunk } });
+
+        bytes += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+void UploadManager::submit()
+{
+    reclaim();
+    if (m_copies.empty()) {
+        return;
+    }
+
+    vmaFlushAllocation(*m_allocator, m_staging.allocation, 0, VK_WHOLE_SIZE);
+
+    VkCommandBuffer cmd;
+    if (!m_freeCommandBuffers.empty()) {
+        cmd = m_freeCommandBuffers.back();
+        m_freeCommandBuffers.pop_back();
+        vkResetCommandBuffer(cmd, 0);
+    } else {
+        VkCommandBufferAllocateInfo allocInfo {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = m_commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(m_device, &allocInfo, &cmd) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate upload command buffer");
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(cmd, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin upload command buffer");
+    }
+
+    // Copies into the same buffer go out as one command
+    std::vector<VkBufferCopy> regions;
+    for (size_t i = 0; i < m_copies.size(); ++i) {
+        regions.push_back(m_copies[i].region);
+        if (i + 1 == m_copies.size() || m_copies[i + 1].dst != m_copies[i].dst) {
+            vkCmdCopyBuffer(cmd, m_staging.buffer, m_copies[i].dst, (uint32_t)regions.size(), regions.data());
+            regions.clear();
+        }
+    }
+
+    // Buffers are exclusive to one queue family, so the graphics queue has to take the written ranges over. The
+    // release half goes here and the matching acquire into the next frame.
+    if (m_queueFamily != m_graphicsFamily) {
+        std::vector<VkBufferMemoryBarrier> releases;
+        for (const Copy& copy : m_copies) {
+            VkBufferMemoryBarrier barrier {};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcQueueFamilyIndex = m_queueFamily;
+            barrier.dstQueueFamilyIndex = m_graphicsFamily;
+            barrier.buffer = copy.dst;
+            barrier.offset = copy.region.dstOffset;
+            barrier.size = copy.region.size;
+
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            releases.push_back(barrier);
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+            m_pendingAcquires.push_back(barrier);
+        }
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, (uint32_t)releases.size(), releases.data(), 0, nullptr);
+    }
+
+    if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to end upload command buffer");
+    }
+
+    uint64_t signalValue = m_submittedValue + 1;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &m_timeline;
+
+    if (vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit uploads");
+    }
+
+    m_submittedValue = signalValue;
+    m_inFlight.push_back({ cmd, signalValue, m_head });
+    m_copies.clear();
+}
+
+void UploadManager::record_acquires(VkCommandBuffer cmd)
+{
+    if (m_pendingAcquires.empty()) {
+        return;
+    }
+
+    // The wait on the timeline semaphore is at VERTEX_INPUT, which this chains onto
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        0, 0, nullptr, (uint32_t)m_pendingAcquires.size(), m_pendingAcquires.data(), 0, nullptr);
+    m_pendingAcquires.clear();
+}
+
+VkDeviceSize UploadManager::reserve(VkDeviceSize size)
+{
+    // Keeps copy offsets aligned for the transfer engines
+    size = (size + 15) & ~VkDeviceSize(15);
+
+    for (;;) {
+        reclaim();
+
+        // A reservation never wraps around the end of the ring, the rest of the ring is skipped instead
+        VkDeviceSize position = m_head % m_stagingSize;
+        VkDeviceSize padding = position + size > m_stagingSize ? m_stagingSize - position : 0;
+        if (m_head + padding + size - m_tail <= m_stagingSize) {
+            m_head += padding;
+            VkDeviceSize offset = m_head % m_stagingSize;
+            m_head += size;
+            return offset;
+        }
+
+        // Out of room, so get the queued copies going and wait for the oldest submission to free its space
+        if (m_inFlight.empty()) {
+            submit();
+        }
+        if (m_inFlight.empty()) {
+            throw std::runtime_error("Staging ring is out of space");
+        }
+
+        VkSemaphoreWaitInfo waitInfo {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &m_timeline;
+        waitInfo.pValues = &m_inFlight.front().value;
+        if (vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to wait for uploads");
+        }
+    }
+}
+
+void UploadManager::reclaim()
+{
+    if (m_inFlight.empty()) {
+        return;
+    }
+
+    uint64_t completed = 0;
+    if (vkGetSemaphoreCounterValue(m_device, m_timeline, &completed) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to query upload progress");
+    }
+
+    while (!m_inFlight.empty() && m_inFlight.front().value <= completed) {
+        m_tail = m_inFlight.front().stagingHead;
+        m_freeCommandBuffers.push_back(m_inFlight.front().cmd);
+        m_inFlight.pop_front();
+    }
+}
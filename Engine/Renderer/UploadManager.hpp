@@ -0,0 +1,75 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <ThirdParty/vk_mem_alloc.h>
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include <Renderer/VulkanTypes.hpp>
+
+// Streams data into device-local buffers. Uploads are copied into a persistently mapped staging ring right away and
+// the copies are submitted together once per frame, on a dedicated transfer queue when the device has one. Every
+// submission signals the next value of a timeline semaphore, which the graphics queue waits on before drawing, so
+// neither side ever blocks the CPU unless the staging ring fills up.
+class UploadManager {
+public:
+    void init(vkb::Device& device, VmaAllocator* allocator, VkDeviceSize stagingSize);
+    void cleanup();
+
+    // Queues a copy of size bytes from data to offset in dst. dst must have been created with
+    // VK_BUFFER_USAGE_TRANSFER_DST_BIT and must not be used before the next submit.
+    void upload(VkBuffer dst, VkDeviceSize offset, const void* data, VkDeviceSize size);
+    // Submits the copies queued since the last submit, if there are any
+    void submit();
+
+    // Takes ownership of the ranges the transfer queue wrote back for the graphics queue. Has to be recorded into a
+    // graphics submission that waits on get_semaphore() for get_submitted_value() at VERTEX_INPUT.
+    void record_acquires(VkCommandBuffer cmd);
+
+    VkSemaphore get_semaphore() { return m_timeline; }
+    uint64_t get_submitted_value() { return m_submittedValue; }
+
+private:
+    struct Copy {
+        VkBuffer dst;
+        VkBufferCopy region;
+    };
+
+    struct Submission {
+        VkCommandBuffer cmd;
+        uint64_t value;
+        // Staging ring head after the copies of this submission
+        VkDeviceSize stagingHead;
+    };
+
+    // Returns where in the staging ring size bytes can be written, waiting for earlier copies to finish if needed
+    VkDeviceSize reserve(VkDeviceSize size);
+    // Frees the staging space and command buffers of the submissions that have finished
+    void reclaim();
+
+    VkDevice m_device = VK_NULL_HANDLE;
+    VmaAllocator* m_allocator = nullptr;
+
+    VkQueue m_queue = VK_NULL_HANDLE;
+    uint32_t m_queueFamily = 0;
+    uint32_t m_graphicsFamily = 0;
+
+    AllocatedBuffer m_staging;
+    char* m_mapped = nullptr;
+    VkDeviceSize m_stagingSize = 0;
+    // Only ever go up, the position in the ring is taken modulo m_stagingSize
+    VkDeviceSize m_head = 0;
+    VkDeviceSize m_tail = 0;
+
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> m_freeCommandBuffers;
+    std::deque<Submission> m_inFlight;
+
+    std::vector<Copy> m_copies;
+    std::vector<VkBufferMemoryBarrier> m_pendingAcquires;
+
+    VkSemaphore m_timeline = VK_NULL_HANDLE;
+    uint64_t m_submittedValue = 0;
+};
@@ -0,0 +1,157 @@
+#include "SpatialIndex.hpp"
+
+#include <algorithm>
+
+SpatialIndex::SpatialIndex(float margin)
+    : m_tree(margin)
+    , m_entries(ECS::MAX_ENTITIES)
+{
+}
+
+void SpatialIndex::init()
+{
+    ECS::EntityManager em;
+    em.on_entity_relocated([this](size_t from, size_t to) { on_relocated(from, to); });
+}
+
+void SpatialIndex::exit()
+{
+    m_tree.clear();
+    m_tracked.clear();
+    m_relocated.clear();
+    std::fill(m_entries.begin(), m_entries.end(), Entry {});
+}
+
+void SpatialIndex::update(double dt_ms)
+{
+    ECS::EntityManager em;
+    ECS::ComponentView<Transform> transforms = em.view<Transform>();
+    ECS::ComponentView<Bounds> bounds = em.view<Bounds>();
+    ++m_updateCount;
+
+    for (const TransformChanged& changed : em.events<TransformChanged>()) {
+        refit(changed.eid, transforms, bounds);
+    }
+    for (uint32_t eid : m_relocated) {
+        refit(eid, transforms, bounds);
+    }
+    m_relocated.clear();
+
+    // Drop proxies of entities that were removed or lost one of the components, which only takes a look at the masks
+    std::erase_if(m_tracked, [&](uint32_t eid) {
+        Entry& entry = m_entries[eid];
+        if (entry.proxy != AABBTree::NULL_NODE && (transforms.get(eid) == nullptr || bounds.get(eid) == nullptr)) {
+            m_tree.destroy_proxy(entry.proxy);
+            entry.proxy = AABBTree::NULL_NODE;
+        }
+
+        if (entry.proxy == AABBTree::NULL_NODE) {
+            entry.tracked = false;
+            return true;
+        }
+        return false;
+    });
+}
+
+void SpatialIndex::refit(uint32_t eid, const ECS::ComponentView<Transform>& transforms, const ECS::ComponentView<Bounds>& bounds)
+{
+    Transform* transform = transforms.get(eid);
+    Bounds* local = bounds.get(eid);
+    Entry& entry = m_entries[eid];
+    if (transform == nullptr || local == nullptr || entry.refitUpdate == m_updateCount) {
+        return;
+    }
+
+    entry.refitUpdate = m_updateCount;
+    entry.worldBounds = transform_aabb(local->local, transform->getTransform());
+
+    if (entry.proxy == AABBTree::NULL_NODE) {
+        entry.proxy = m_tree.create_proxy(entry.worldBounds, eid);
+        if (!entry.tracked) {
+            entry.tracked = true;
+            m_tracked.push_back(eid);
+        }
+    } else {
+        m_tree.move_proxy(entry.proxy, entry.worldBounds);
+    }
+}
+
+void SpatialIndex::on_relocated(size_t from, size_t to)
+{
+    Entry& source = m_entries[from];
+    if (source.proxy == AABBTree::NULL_NODE) {
+        return;
+    }
+
+    // The destination may still hold the proxy of an entity that was removed since the last update
+    Entry& destination = m_entries[to];
+    if (destination.proxy != AABBTree::NULL_NODE) {
+        m_tree.destroy_proxy(destination.proxy);
+    }
+
+    bool wasTracked = destination.tracked;
+    destination = source;
+    destination.tracked = true;
+    if (!wasTracked) {
+        m_tracked.push_back((uint32_t)to);
+    }
+    m_tree.set_user_data(destination.proxy, (uint32_t)to);
+    m_relocated.push_back((uint32_t)to);
+
+    // The old eid stays in m_tracked until the next update sweeps it out
+    source.proxy = AABBTree::NULL_NODE;
+}
+
+void SpatialIndex::query_box(const AABB& box, std::vector<uint32_t>& eids) const
+{
+    eids.clear();
+    m_tree.query([&](const AABB& aabb) { return aabb.overlaps(box); },
+        [&](uint32_t eid) {
+            if (m_entries[eid].worldBounds.overlaps(box)) {
+                eids.push_back(eid);
+            }
+        });
+}
+
+void SpatialIndex::query_sphere(const Sphere& sphere, std::vector<uint32_t>& eids) const
+{
+    eids.clear();
+    m_tree.query([&](const AABB& aabb) { return overlaps(aabb, sphere); },
+        [&](uint32_t eid) {
+            if (overlaps(m_entries[eid].worldBounds, sphere)) {
+                eids.push_back(eid);
+            }
+        });
+}
+
+void SpatialIndex::query_frustum(const Frustum& frustum, std::vector<uint32_t>& eids) const
+{
+    eids.clear();
+    m_tree.query([&](const AABB& aabb) { return frustum.intersects(aabb); },
+        [&](uint32_t eid) {
+            if (frustum.intersects(m_entries[eid].worldBounds)) {
+                eids.push_back(eid);
+            }
+        });
+}
+
+void SpatialIndex::query_ray(glm::vec3 origin, glm::vec3 direction, float maxDistance, std::vector<uint32_t>& eids) const
+{
+    glm::vec3 invDirection = glm::vec3(1.0f) / direction;
+    float distance;
+
+    m_rayHits.clear();
+    m_tree.query([&](const AABB& aabb) { return intersect_ray(aabb, origin, invDirection, maxDistance, distance); },
+        [&](uint32_t eid) {
+            if (intersect_ray(m_entries[eid].worldBounds, origin, invDirection, maxDistance, distance)) {
+                m_rayHits.emplace_back(distance, eid);
+            }
+        });
+
+    std::sort(m_rayHits.begin(), m_rayHits.end());
+
+    eids.clear();
+    for (const auto& hit : m_rayHits) {
+        eids.push_back(hit.second);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <AABBTree.hpp>
+#include <Bounds.hpp>
+#include <ECS/ECS.hpp>
+#include <Transform.hpp>
+
+// Keeps an AABBTree over every entity that has both a Transform and Bounds. Each update only refits the entities named
+// by the TransformChanged events of the previous update, so writers of Transform or Bounds have to emit one, also when
+// adding them. Most refits stay inside their enlarged leaf and cost no tree work at all. Add it before the systems
+// that query it. Queries fill eids with the entities whose world bounds, as of the previous update, pass the test.
+class SpatialIndex : public ECS::System {
+public:
+    SpatialIndex(float margin = 0.1f);
+
+    void init() override;
+    void update(double dt_ms) override;
+    void exit() override;
+
+    void query_box(const AABB& box, std::vector<uint32_t>& eids) const;
+    void query_sphere(const Sphere& sphere, std::vector<uint32_t>& eids) const;
+    void query_frustum(const Frustum& frustum, std::vector<uint32_t>& eids) const;
+    // Hits are sorted from nearest to farthest
+    void query_ray(glm::vec3 origin, glm::vec3 direction, float maxDistance, std::vector<uint32_t>& eids) const;
+
+    const AABB& get_world_bounds(uint32_t eid) const { return m_entries[eid].worldBounds; }
+
+private:
+    struct Entry {
+        int proxy = AABBTree::NULL_NODE;
+        // Whether the eid is in m_tracked, which can be true for a while after the proxy is gone
+        bool tracked = false;
+        // The update that last refit it, an entity can be named by several events
+        uint64_t refitUpdate = 0;
+        AABB worldBounds;
+    };
+
+    void refit(uint32_t eid, const ECS::ComponentView<Transform>& transforms, const ECS::ComponentView<Bounds>& bounds);
+    void on_relocated(size_t from, size_t to);
+
+    AABBTree m_tree;
+    std::vector<Entry> m_entries;
+    // Every eid that had a proxy at some point since the last update
+    std::vector<uint32_t> m_tracked;
+    // Entities moved by compaction since the last update. Events emitted before that still name their old eid.
+    std::vector<uint32_t> m_relocated;
+    uint64_t m_updateCount = 0;
+
+    mutable std::vector<std::pair<float, uint32_t>> m_rayHits;
+};
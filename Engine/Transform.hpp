@@ -1,5 +1,6 @@
 #pragma once
 #include <ThirdParty/glm/glm.hpp>
+#include <ThirdParty/glm/gtx/transform.hpp>
 
 struct Transform {
     Transform(glm::vec3 pos = {}, glm::vec3 rot = {}, glm::vec3 scale = glm::vec3(1.0f))
@@ -26,4 +27,21 @@ struct Transform {
     glm::vec3 pos {};
     glm::vec3 rot {};
     glm::vec3 scale = glm::vec3(1.0f);
-};
\ No newline at end of file
+};
+
+// The Transform of an entity as of the previous simulation tick. Entities that have one are rendered
+// interpolated between it and their current Transform.
+struct PreviousTransform {
+    Transform transform;
+};
+
+// Event to emit with EntityManager::emit() after writing the Transform of an entity, including when adding it. Systems
+// that cache something derived from transforms, like SpatialIndex, only look at the entities named by these.
+struct TransformChanged {
+    uint32_t eid;
+};
+
+inline Transform interpolate(const Transform& from, const Transform& to, float alpha)
+{
+    return Transform(glm::mix(from.pos, to.pos, alpha), glm::mix(from.rot, to.rot, alpha), glm::mix(from.scale, to.scale, alpha));
+}
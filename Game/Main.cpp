@@ -1,11 +1,15 @@
 #define SDL_MAIN_HANDLED
 
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 #include <SDL.h>
 
 #include <Application.hpp>
 #include <ECS/ECS.hpp>
+#include <FixedTimestep.hpp>
 #include <Renderer/Renderer.hpp>
 
 using namespace ECS;
@@ -17,46 +21,127 @@ public:
     {
         EntityManager em;
         em.each_component<Transform>([](ECS::Entity& e, Transform* t) {
-            t->rot.y += 0.5f;
+            t->rot.y += 0.03f * (float)dt_ms;
         });
     }
     void exit() override { }
 };
 
-int main()
+static void create_scene(Renderer& renderer)
 {
+    EntityManager em;
+    em.add_system<TransformHistory>();
+    em.add_system<MeshRotate>();
+
+    Entity triangle = em.add_entity();
+    triangle.add_component<Mesh>(renderer.get_global_data());
+    Mesh* triMesh = triangle.get_component<Mesh>().value();
+
+    std::vector<Vertex> triVerts(3);
+    triVerts[0].pos = glm::vec3(1.f, 1.f, 0.f);
+    triVerts[1].pos = glm::vec3(-1.f, 1.f, 0.f);
+    triVerts[2].pos = glm::vec3(0.f, -1.f, 0.f);
+
+    triVerts[0].color = glm::vec3(1.f, 0.f, 0.f);
+    triVerts[1].color = glm::vec3(0.f, 1.f, 0.f);
+    triVerts[2].color = glm::vec3(0.f, 0.f, 1.f);
+
+    triMesh->set_vertices(triVerts);
+
+    triangle.add_component<Transform>();
+    triangle.add_component<PreviousTransform>();
+}
+
+// Renders a fixed number of frames without a window, one simulation tick per frame so that the output doesn't depend
+// on how fast the machine is. If capturePath is set the last frame is written there as a binary PPM.
+static void run_headless(int frameCount, const char* capturePath, bool gpuCulling)
+{
+    Renderer renderer(640, 480, capturePath != nullptr);
+    renderer.get_global_data()->gpuCulling = gpuCulling;
+    renderer.init();
+    create_scene(renderer);
+
+    EntityManager em;
+    for (int i = 0; i < frameCount; ++i) {
+        em.update(1000.0 / 60.0);
+        renderer.update();
+    }
+
+    if (capturePath) {
+        std::vector<uint8_t> rgba;
+        renderer.read_pixels(rgba);
+
+        VkExtent2D size = renderer.get_global_data()->windowSize;
+        std::ofstream file(capturePath, std::ios::binary);
+        file << "P6\n"
+             << size.width << " " << size.height << "\n255\n";
+        for (size_t i = 0; i < rgba.size(); i += 4) {
+            file.write((const char*)&rgba[i], 3);
+        }
+    }
+
+    std::cout << "Recorded draw commands " << renderer.get_global_data()->commandRecordings << " times in "
+              << frameCount << " frames" << std::endl;
+
+    if (const char* timingsPath = std::getenv("FRONTIER_SYSTEM_TIMINGS")) {
+        em.dump_system_timings(timingsPath);
+    }
+
+    renderer.exit();
+}
+
+int main(int argc, char** argv)
+{
+    int headlessFrames = 0;
+    const char* capturePath = nullptr;
+    bool gpuCulling = true;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--cpu-culling") == 0) {
+            gpuCulling = false;
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--headless") == 0) {
+            headlessFrames = std::atoi(argv[++i]);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--capture") == 0) {
+            capturePath = argv[++i];
+        }
+    }
+
+    if (headlessFrames > 0) {
+        try {
+            run_headless(headlessFrames, capturePath, gpuCulling);
+        } catch (std::runtime_error e) {
+            std::cerr << "Unhandled exception: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     try {
         Application app;
         app.init("VulkanTriangle", std::make_tuple(640, 480));
         Renderer renderer(app.getWindow());
+        renderer.get_global_data()->gpuCulling = gpuCulling;
         renderer.init();
+        create_scene(renderer);
 
         EntityManager em;
-        em.add_system<MeshRotate>();
-
-        Entity triangle = em.add_entity();
-        triangle.add_component<Mesh>(renderer.get_global_data());
-        Mesh* triMesh = triangle.get_component<Mesh>().value();
-
-        std::vector<Vertex> triVerts(3);
-        triVerts[0].pos = glm::vec3(1.f, 1.f, 0.f);
-        triVerts[1].pos = glm::vec3(-1.f, 1.f, 0.f);
-        triVerts[2].pos = glm::vec3(0.f, -1.f, 0.f);
-
-        triVerts[0].color = glm::vec3(1.f, 0.f, 0.f);
-        triVerts[1].color = glm::vec3(0.f, 1.f, 0.f);
-        triVerts[2].color = glm::vec3(0.f, 0.f, 1.f);
-
-        triMesh->set_vertices(triVerts);
-
-        triangle.add_component<Transform>();
 
+        FixedTimestep timestep;
         while (!app.shouldExit()) {
             app.processEvents();
-            em.update(0.01f);
+
+            timestep.begin_frame();
+            while (timestep.step()) {
+                em.update(timestep.tick_ms());
+            }
+
+            renderer.get_global_data()->interpolationAlpha = timestep.alpha();
             renderer.update();
         }
 
+        if (const char* timingsPath = std::getenv("FRONTIER_SYSTEM_TIMINGS")) {
+            em.dump_system_timings(timingsPath);
+        }
+
         renderer.exit();
         app.exit();
     } catch (std::runtime_error e) {
@@ -5,6 +5,8 @@ layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec3 vColor;
 
 layout (location = 0) out vec3 outColor;
+// In model space, for lighting once mesh.frag does any
+layout (location = 1) out vec3 outNormal;
 
 layout(set = 0, binding = 0) uniform CameraBuffer {
 	mat4 view;
@@ -17,12 +19,13 @@ layout(std140, set = 0, binding = 1) readonly buffer sceneBuffer {
 
 layout(push_constant) uniform constants
 {
-	uint index;
+	uint baseInstance;
 } pushConstants;
 
 void main()
 {
-	mat4 transformMatrix = (cameraData.proj * cameraData.view * sceneData.models[pushConstants.index]);
+	mat4 transformMatrix = (cameraData.proj * cameraData.view * sceneData.models[pushConstants.baseInstance + gl_InstanceIndex]);
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
 	outColor = vColor;
+	outNormal = vNormal;
 }
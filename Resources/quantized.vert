@@ -0,0 +1,43 @@
+#version 450
+
+// QuantizedVertex, see Mesh.hpp. The model matrices of quantized meshes take the positions from the [-1, 1] box back to
+// the mesh bounds.
+layout (location = 0) in vec4 vPosition;
+// Octahedral encoded by encode_octahedral in MeshProcessing.cpp
+layout (location = 1) in vec2 vNormal;
+layout (location = 2) in vec4 vColor;
+
+layout (location = 0) out vec3 outColor;
+// In model space, for lighting once mesh.frag does any
+layout (location = 1) out vec3 outNormal;
+
+layout(set = 0, binding = 0) uniform CameraBuffer {
+	mat4 view;
+	mat4 proj;
+} cameraData;
+
+layout(std140, set = 0, binding = 1) readonly buffer sceneBuffer {
+	mat4 models[];
+} sceneData;
+
+layout(push_constant) uniform constants
+{
+	uint baseInstance;
+} pushConstants;
+
+vec3 decode_octahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	if (normal.z < 0.0f) {
+		normal.xy = (1.0f - abs(encoded.yx)) * vec2(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(normal);
+}
+
+void main()
+{
+	mat4 transformMatrix = (cameraData.proj * cameraData.view * sceneData.models[pushConstants.baseInstance + gl_InstanceIndex]);
+	gl_Position = transformMatrix * vec4(vPosition.xyz, 1.0f);
+	outColor = vColor.rgb;
+	outNormal = decode_octahedral(vNormal);
+}